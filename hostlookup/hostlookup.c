@@ -3,6 +3,29 @@
  *
  * Prints a lot of information about a hostname.
  *
+ * With --bench, replays a list of names through the same lookups at a
+ * target rate or fixed concurrency and reports throughput and latency.
+ *
+ * With --sweep, reverse-resolves whole CIDR ranges.
+ *
+ * With --hosts, names and addresses in a hosts file are answered from an
+ * in-memory index instead of a linear scan through NSS.
+ *
+ * With --watch, re-resolves the names on a timer and prints only changes.
+ *
+ * With --probe, races TCP connections to every address and ranks them.
+ *
+ * With --split, the AF_INET and AF_INET6 lookups run concurrently.
+ *
+ * With --batch, prints one line per name, optionally warm-started from a
+ * --snapshot of the previous run's results.
+ *
+ * With --enrich, copies a log through, adding PTRs after its addresses.
+ *
+ * With --serve, answers lookups over a UNIX socket, coalescing duplicates.
+ *
+ * With --compare, times every resolution backend side by side.
+ *
  * Author: Matthew Kerwin <matthew.kerwin@qut.edu.au>
  *
  * Copyright (c) 2012-2016, QUT Library eServices <libsys@qut.edu.au>
@@ -23,9 +46,23 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <sys/stat.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <signal.h>
 
 #ifndef   NI_MAXHOST
 #define   NI_MAXHOST 1025
@@ -155,153 +192,4126 @@ char *myerr(int e)
 	case NO_ADDRESS: return "NO_ADDRESS";
 /*	case NO_DATA: return "NO_DATA";*/
 	case TRY_AGAIN: return "TRY_AGAIN";
+	case NO_RECOVERY: return "NO_RECOVERY";
+	case NETDB_INTERNAL: return "NETDB_INTERNAL";
 	default: return "???";
 	}
 }
 
-int main(int argc, char *argv[])
+#define HOSTNAME_LEN 256
+#define MAX_ADDRS    32
+
+/* which lookups resolve() performs */
+#define RESOLVE_LEGACY  0x01	/* gethostbyname_r(), and gethostbyaddr_r() for IPv4 */
+#define RESOLVE_MODERN  0x02	/* getaddrinfo() */
+#define RESOLVE_REVERSE 0x04	/* getnameinfo() on each address */
+#define RESOLVE_ALL     (RESOLVE_LEGACY|RESOLVE_MODERN|RESOLVE_REVERSE)
+
+struct resolved_addr {
+	int family;
+	unsigned char addr[16];
+	char ptr[HOSTNAME_LEN];	/* "" if there is no PTR record */
+	int ptr_error;		/* getnameinfo() failed, other than EAI_NONAME */
+};
+
+/*
+ * The results of the same lookups dump_name() performs, collected
+ * instead of printed.  Addresses are de-duplicated across socket types.
+ */
+struct resolution {
+	int h_error;	/* gethostbyname_r() */
+	int gai_error;	/* getaddrinfo() */
+	unsigned long long gai_ns[2];	/* with --split: AF_INET and AF_INET6 */
+	int gai_errors[2];
+	int ni_error;	/* first failed getnameinfo(), other than EAI_NONAME */
+	int ha_error;	/* first failed gethostbyaddr_r() */
+	char h_name[HOSTNAME_LEN];
+	char canon[HOSTNAME_LEN];
+	int naddrs;
+	struct resolved_addr addrs[MAX_ADDRS];
+};
+
+unsigned long long now_ns(void)
 {
-	struct addrinfo  hints;
-	struct addrinfo *result;
-	struct addrinfo *res;
-	struct sockaddr_in *in;
-	struct sockaddr_in6 *in6;
-	struct hostent *host;
-	struct in_addr *ad;
-	struct in6_addr *ad6;
-	int at;
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void sleep_until(unsigned long long ns)
+{
+	struct timespec ts;
+	ts.tv_sec = ns / 1000000000ULL;
+	ts.tv_nsec = ns % 1000000000ULL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+void copy_name(char *dst, const char *src)
+{
+	strncpy(dst, src, HOSTNAME_LEN - 1);
+	dst[HOSTNAME_LEN - 1] = 0;
+}
+
+/* Returns the address length for AF_INET/AF_INET6, or 0. */
+int addr_len(int af)
+{
+	switch (af) {
+	case AF_INET: return 4;
+	case AF_INET6: return 16;
+	}
+	return 0;
+}
+
+/* Builds a sockaddr for the given raw address; returns its length. */
+socklen_t make_sockaddr(int af, const unsigned char *addr, int port, struct sockaddr_storage *ss)
+{
+	struct sockaddr_in *in = (struct sockaddr_in*)ss;
+	struct sockaddr_in6 *in6 = (struct sockaddr_in6*)ss;
+
+	memset(ss, 0, sizeof(*ss));
+	if (af == AF_INET) {
+		in->sin_family = AF_INET;
+		in->sin_port = htons(port);
+		memcpy(&in->sin_addr, addr, 4);
+		return sizeof(*in);
+	}
+	in6->sin6_family = AF_INET6;
+	in6->sin6_port = htons(port);
+	memcpy(&in6->sin6_addr, addr, 16);
+	return sizeof(*in6);
+}
+
+void format_addr(int af, const unsigned char *addr, char *buf, size_t len)
+{
+	if (!inet_ntop(af, addr, buf, len)) {
+		snprintf(buf, len, "???");
+	}
+}
+
+void add_raw_address(struct resolution *r, int af, const unsigned char *addr)
+{
+	struct resolved_addr *ra;
+	int i, n;
+
+	n = addr_len(af);
+	for (i = 0; i < r->naddrs; i++) {
+		if (r->addrs[i].family == af && memcmp(r->addrs[i].addr, addr, n) == 0) {
+			return;
+		}
+	}
+	if (r->naddrs == MAX_ADDRS) {
+		return;
+	}
+	ra = &r->addrs[r->naddrs++];
+	memset(ra, 0, sizeof(*ra));
+	ra->family = af;
+	memcpy(ra->addr, addr, n);
+}
+
+/*
+ * gethostbyname_r(), growing the scratch buffer as needed.  With found,
+ * the addresses are added to it too.
+ */
+int legacy_byname(const char *name, char *h_name, struct resolution *found)
+{
+	struct hostent he, *host = NULL;
+	char *buf = NULL, *tmp;
+	char **ap;
+	size_t len = 4096;
+	int rc, herr = 0;
+
+	do {
+		len *= 2;
+		if (!(tmp = realloc(buf, len))) break;
+		buf = tmp;
+		rc = gethostbyname_r(name, &he, buf, len, &host, &herr);
+	} while (rc == ERANGE && len < 65536);
+	if (host) {
+		copy_name(h_name, host->h_name);
+		for (ap = host->h_addr_list; found && *ap; ap++) {
+			add_raw_address(found, host->h_addrtype, (unsigned char*)*ap);
+		}
+	}
+	free(buf);
+	return host ? 0 : (herr ? herr : NO_RECOVERY);
+}
+
+/* gethostbyaddr_r(), growing the scratch buffer as needed */
+int legacy_byaddr(int af, const unsigned char *addr, char *h_name)
+{
+	struct hostent he, *host = NULL;
+	char *buf = NULL, *tmp;
+	size_t len = 4096;
+	int rc, herr = 0;
+
+	do {
+		len *= 2;
+		if (!(tmp = realloc(buf, len))) break;
+		buf = tmp;
+		rc = gethostbyaddr_r(addr, addr_len(af), af, &he, buf, len, &host, &herr);
+	} while (rc == ERANGE && len < 65536);
+	if (host && h_name) {
+		copy_name(h_name, host->h_name);
+	}
+	free(buf);
+	return host ? 0 : (herr ? herr : NO_RECOVERY);
+}
+
+/* getnameinfo() for a raw address; EAI_NONAME leaves ptr empty */
+int reverse_addr(int af, const unsigned char *addr, char *ptr)
+{
+	struct sockaddr_storage ss;
+	socklen_t sslen;
 	int error;
-	int i;
-	char hostname[NI_MAXHOST];
-	char **alias;
 
-	for (i = 1; i < argc; i++) {
-		printf("***\n*** %s\n***\n\n", argv[i]);
+	*ptr = 0;
+	sslen = make_sockaddr(af, addr, 0, &ss);
+	error = getnameinfo((struct sockaddr*)&ss, sslen, ptr, HOSTNAME_LEN, NULL, 0, NI_NAMEREQD);
+	if (error != 0) {
+		*ptr = 0;
+	}
+	return error == EAI_NONAME ? 0 : error;
+}
 
-		/* super awesome hack bananas */
-		host = gethostbyname(argv[i]);
-		if (!host) {
-			fprintf(stderr, "error in gethostbyname: %s\n", myerr(h_errno));
-		} else {
-			printf("gethostbyname()\n  hostname: %s\n", host->h_name);
-			for (alias = host->h_aliases; alias && *alias; alias++) {
-				printf("  aka: %s\n", *alias);
+void add_address(struct resolution *r, const struct sockaddr *sa)
+{
+	if (sa->sa_family == AF_INET) {
+		add_raw_address(r, AF_INET, (const unsigned char*)&((const struct sockaddr_in*)sa)->sin_addr);
+	} else if (sa->sa_family == AF_INET6) {
+		add_raw_address(r, AF_INET6, ((const struct sockaddr_in6*)sa)->sin6_addr.s6_addr);
+	}
+}
+
+/*
+ * HOSTS FILE INDEX
+ *
+ * The file is mapped once and indexed by name and by address, so lookups
+ * cost a hash probe rather than a linear scan through NSS.  Names and
+ * aliases point into the mapping; nothing is copied.  The long-running
+ * modes (--serve, --watch) copy the file instead, since a mapping faults
+ * if the file is truncated under it, and rebuild the index when it
+ * changes.
+ */
+
+struct hosts_entry {
+	int family;
+	unsigned char addr[16];
+	const char *names;	/* first name on the line */
+	const char *end;	/* end of the names (comment or end of line) */
+};
+
+struct hosts_slot {
+	const char *key;	/* NULL if empty */
+	unsigned int len;
+	unsigned int entry;
+};
+
+struct hosts_index {
+	const char *path;
+	char *map;
+	size_t size;
+	int copied;		/* map is a malloc()ed copy, not a mapping */
+	struct stat sb;		/* the file as it was read */
+	struct hosts_entry *entries;
+	unsigned int nentries;
+	struct hosts_slot *byname;
+	unsigned int name_mask;
+	unsigned int *byaddr;	/* entry + 1, or 0 if empty */
+	unsigned int addr_mask;
+};
+
+struct hosts_index *hosts = NULL;
+
+int is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/* Returns the next name in [p,end), or NULL; sets *len. */
+const char *next_name(const char *p, const char *end, unsigned int *len)
+{
+	const char *q;
+	while (p < end && is_space(*p)) p++;
+	if (p == end) return NULL;
+	for (q = p; q < end && !is_space(*q); q++) ;
+	*len = q - p;
+	return p;
+}
+
+unsigned int hash_name(const char *s, unsigned int len)
+{
+	unsigned int h = 2166136261u;
+	unsigned int i;
+	for (i = 0; i < len; i++) {
+		h = (h ^ (unsigned char)(s[i] | 0x20)) * 16777619u;
+	}
+	return h;
+}
+
+unsigned int hash_addr(int af, const unsigned char *addr)
+{
+	unsigned int h = 2166136261u ^ af;
+	int i, n = addr_len(af);
+	for (i = 0; i < n; i++) {
+		h = (h ^ addr[i]) * 16777619u;
+	}
+	return h;
+}
+
+unsigned int table_size(unsigned int n)
+{
+	unsigned int size = 16;
+	while (size < n * 2) size <<= 1;
+	return size;
+}
+
+int add_entry(struct hosts_index *hi, const char *line, const char *eol)
+{
+	struct hosts_entry *e, *tmp;
+	const char *p, *end;
+	char text[INET6_ADDRSTRLEN + 1];
+	unsigned int len;
+
+	for (end = line; end < eol && *end != '#'; end++) ;
+	if (!(p = next_name(line, end, &len)) || len >= sizeof(text)) return 0;
+	memcpy(text, p, len);
+	text[len] = 0;
+
+	if (!(hi->nentries & (hi->nentries - 1))) {
+		tmp = realloc(hi->entries, (hi->nentries ? hi->nentries * 2 : 1) * sizeof(*tmp));
+		if (!tmp) return -1;
+		hi->entries = tmp;
+	}
+	e = &hi->entries[hi->nentries];
+	if (inet_pton(AF_INET, text, e->addr) == 1) {
+		e->family = AF_INET;
+	} else if (inet_pton(AF_INET6, text, e->addr) == 1) {
+		e->family = AF_INET6;
+	} else {
+		return 0;	/* e.g. scoped fe80::1%eth0; left to NSS */
+	}
+	e->names = p + len;
+	e->end = end;
+	if (!next_name(e->names, end, &len)) return 0;
+	hi->nentries ++;
+	return 0;
+}
+
+void hosts_close(struct hosts_index *hi)
+{
+	if (hi->copied) {
+		free(hi->map);
+	} else if (hi->map) {
+		munmap(hi->map, hi->size);
+	}
+	free(hi->entries);
+	free(hi->byname);
+	free(hi->byaddr);
+	free(hi);
+}
+
+/* Maps the file, or with copy, reads it into memory. */
+int hosts_read(struct hosts_index *hi, int fd, int copy)
+{
+	size_t got = 0;
+	ssize_t n;
+
+	if (!hi->size) {
+		return 0;
+	}
+	if (!copy) {
+		hi->map = mmap(NULL, hi->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (hi->map == MAP_FAILED) {
+			hi->map = NULL;
+			return -1;
+		}
+		madvise(hi->map, hi->size, MADV_SEQUENTIAL);
+		return 0;
+	}
+	hi->copied = 1;
+	if (!(hi->map = malloc(hi->size))) {
+		return -1;
+	}
+	while (got < hi->size && (n = read(fd, hi->map + got, hi->size - got)) != 0) {
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		got += n;
+	}
+	hi->size = got;		/* shorter if it was truncated meanwhile */
+	return 0;
+}
+
+struct hosts_index *hosts_open(const char *path, int copy)
+{
+	struct hosts_index *hi;
+	struct hosts_entry *e;
+	struct hosts_slot *slot;
+	const char *p, *eol, *name;
+	unsigned int i, j, len, nnames = 0;
+	int fd;
+
+	if (!(hi = calloc(1, sizeof(*hi)))) return NULL;
+	hi->path = path;
+	if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &hi->sb) < 0) {
+		perror(path);
+		if (fd >= 0) close(fd);
+		free(hi);
+		return NULL;
+	}
+	hi->size = hi->sb.st_size;
+	if (hosts_read(hi, fd, copy) != 0) {
+		perror(path);
+		close(fd);
+		hosts_close(hi);
+		return NULL;
+	}
+	close(fd);
+
+	for (p = hi->map; p < hi->map + hi->size; p = eol + 1) {
+		if (!(eol = memchr(p, '\n', hi->map + hi->size - p))) {
+			eol = hi->map + hi->size;
+		}
+		if (add_entry(hi, p, eol) != 0) {
+			perror("realloc");
+			hosts_close(hi);
+			return NULL;
+		}
+	}
+
+	for (i = 0; i < hi->nentries; i++) {
+		e = &hi->entries[i];
+		for (p = e->names; (name = next_name(p, e->end, &len)); p = name + len) {
+			nnames ++;
+		}
+	}
+	hi->name_mask = table_size(nnames) - 1;
+	hi->addr_mask = table_size(hi->nentries) - 1;
+	hi->byname = calloc(hi->name_mask + 1, sizeof(*hi->byname));
+	hi->byaddr = calloc(hi->addr_mask + 1, sizeof(*hi->byaddr));
+	if (!hi->byname || !hi->byaddr) {
+		perror("calloc");
+		hosts_close(hi);
+		return NULL;
+	}
+
+	/* Inserting in file order with linear probing means duplicates are
+	 * found in file order too, as NSS would return them. */
+	for (i = 0; i < hi->nentries; i++) {
+		e = &hi->entries[i];
+		for (p = e->names; (name = next_name(p, e->end, &len)); p = name + len) {
+			for (j = hash_name(name, len); hi->byname[j & hi->name_mask].key; j++) ;
+			slot = &hi->byname[j & hi->name_mask];
+			slot->key = name;
+			slot->len = len;
+			slot->entry = i;
+		}
+		for (j = hash_addr(e->family, e->addr); hi->byaddr[j & hi->addr_mask]; j++) {
+			if (hi->entries[hi->byaddr[j & hi->addr_mask] - 1].family == e->family &&
+			    memcmp(hi->entries[hi->byaddr[j & hi->addr_mask] - 1].addr, e->addr, addr_len(e->family)) == 0) {
+				break;	/* the first line for an address wins */
 			}
 		}
+		if (!hi->byaddr[j & hi->addr_mask]) {
+			hi->byaddr[j & hi->addr_mask] = i + 1;
+		}
+	}
+	return hi;
+}
 
-		/* resolve the domain name into a list of addresses */
-		memset(&hints, 0, sizeof(struct addrinfo));
-		hints.ai_family = AF_UNSPEC; /* AF_INET or AF_INET6 */
-#if 0
-		hints.ai_socktype = 0; /* SOCK_STREAM or SOCK_DGRAM */
-#endif
-		hints.ai_flags = AI_CANONNAME|AI_V4MAPPED;
-#if 0
-		hints.ai_protocol = 0; /* any protocol */
-		hints.ai_canonname = NULL;
-		hints.ai_addr = NULL;
-		hints.ai_next = NULL;
-#endif
-		error = getaddrinfo(argv[i], NULL, &hints, &result);
-		if (error != 0) {
-			fprintf(stderr, "error in getaddrinfo: %s\n", gai_strerror(error));
-			return EXIT_FAILURE;
+/* Whether the file has been replaced or rewritten since it was read. */
+int hosts_changed(const struct hosts_index *hi)
+{
+	struct stat sb;
+	if (stat(hi->path, &sb) < 0) {
+		return 0;	/* mid-replace, perhaps: keep what we have */
+	}
+	return sb.st_dev != hi->sb.st_dev || sb.st_ino != hi->sb.st_ino || sb.st_size != hi->sb.st_size ||
+		sb.st_mtim.tv_sec != hi->sb.st_mtim.tv_sec || sb.st_mtim.tv_nsec != hi->sb.st_mtim.tv_nsec;
+}
+
+/*
+ * Returns a new index if the file has changed since the current one was
+ * built, or NULL.  Swapping it in is the caller's business, since only
+ * it knows when nothing is using the old one.
+ */
+struct hosts_index *hosts_reload(void)
+{
+	if (!hosts || !hosts_changed(hosts)) {
+		return NULL;
+	}
+	return hosts_open(hosts->path, 1);
+}
+
+/* Fills 'found' with the entries for a name, in file order; returns the count. */
+int hosts_byname(const char *name, unsigned int *found, int max)
+{
+	struct hosts_slot *slot;
+	unsigned int j, len = strlen(name);
+	int n = 0;
+
+	if (len && name[len - 1] == '.') len--;
+	for (j = hash_name(name, len); (slot = &hosts->byname[j & hosts->name_mask])->key; j++) {
+		if (slot->len == len && strncasecmp(slot->key, name, len) == 0 &&
+		    n < max && (n == 0 || found[n - 1] != slot->entry)) {
+			found[n++] = slot->entry;
 		}
+	}
+	return n;
+}
 
-		printf("getaddrinfo()\n");
+/* Returns the first entry for an address, or NULL. */
+struct hosts_entry *hosts_byaddr(int af, const unsigned char *addr)
+{
+	struct hosts_entry *e;
+	unsigned int j, k;
 
-		/* loop over all returned results and do inverse lookup */
-		for (res = result; res != NULL; res = res->ai_next) {
-			ad = NULL;
+	for (j = hash_addr(af, addr); (k = hosts->byaddr[j & hosts->addr_mask]); j++) {
+		e = &hosts->entries[k - 1];
+		if (e->family == af && memcmp(e->addr, addr, addr_len(af)) == 0) {
+			return e;
+		}
+	}
+	return NULL;
+}
 
-			printf("  ai_flags = 0x%X ", res->ai_flags);
-			printflags(res->ai_flags);
-			printf("  ai_family = %d [AF_%s]\n  ai_socktype = %d [%s]\n  ai_protocol = %d [%s]\n", res->ai_family, family(res->ai_family), res->ai_socktype, stype(res->ai_socktype), res->ai_protocol, sockop(res->ai_protocol));
-			if (res->ai_canonname && *(res->ai_canonname)) {
-				printf("  ai_canonname = \"%s\"\n", res->ai_canonname);
-			} else {
-				printf("  ai_canonname = NULL\n");
-			}
-			if (res->ai_family == AF_INET) {
-				/* IPv4 */
-				printf("  ai_addr = {\n");
-				if (res->ai_addrlen == sizeof(struct sockaddr_in)) {
-					in = (struct sockaddr_in*)(res->ai_addr);
-					printf("    sin_family = %d [AF_%s]\n    sin_port = %d\n    sin_addr = {\n", in->sin_family, family(in->sin_family), in->sin_port);
-					if (sizeof(in->sin_addr) == sizeof(struct in_addr)) {
-						ad = (struct in_addr*)&(in->sin_addr);
-						at = in->sin_family;
-						printf("      s_addr = 0x%08X (%d.%d.%d.%d)\n", ad->s_addr, ad->s_addr & 0xff, (ad->s_addr >> 8) & 0xff, (ad->s_addr >> 16) & 0xff, ad->s_addr >> 24);
-					} else {
-						printf("      ??? not an in_addr ???\n");
-					}
-					printf("    }\n");
-				} else {
-					printf("    ??? not a sockaddr_in ???\n");
-				}
-				printf("  }\n");
+/* Copies the canonical (first) name of an entry. */
+void entry_name(const struct hosts_entry *e, char *buf, size_t size)
+{
+	unsigned int len;
+	const char *name = next_name(e->names, e->end, &len);
+	if (len >= size) len = size - 1;
+	memcpy(buf, name, len);
+	buf[len] = 0;
+}
 
-				/* use new getnameinfo */
-				memset((void*)hostname, 0, NI_MAXHOST);
-				error = getnameinfo(res->ai_addr, res->ai_addrlen, hostname, NI_MAXHOST, NULL, 0, 0);
-				if (error != 0) {
-					fprintf(stderr, "error in getnameinfo: %s\n", gai_strerror(error));
-				}
-				if (*hostname)
-					printf("  getnameinfo(ai_addr)\n    hostname: %s\n", hostname);
-
-				/* use old gethostbyaddr */
-				if (ad) {
-					host = gethostbyaddr(ad, sizeof(ad), at);
-					if (!host) {
-						fprintf(stderr, "error in gethostbyaddr: %s\n", myerr(h_errno));
-					} else {
-						printf("  gethostbyaddr(ai_addr->sin_addr)\n    hostname: %s\n", host->h_name);
-						for (alias = host->h_aliases; alias && *alias; alias++) {
-							printf("  aka: %s\n", *alias);
-						}
-					}
-				}
-			} else if (res->ai_family == AF_INET6) {
-				/* IPv6 */
-				printf("  ai_addr = {\n");
-				if (res->ai_addrlen == sizeof(struct sockaddr_in6)) {
-					in6 = (struct sockaddr_in6*)(res->ai_addr);
-					printf("    sin6_family = %d [AF_%s]\n    sin6_port = %d\n    sin6_flowinfo = %d\n    sin6_addr = {\n", in6->sin6_family, family(in6->sin6_family), in6->sin6_port, in6->sin6_flowinfo);
-					if (sizeof(in6->sin6_addr) == sizeof(struct in6_addr)) {
-						ad6 = (struct in6_addr*)&(in6->sin6_addr);
-						printf("      s6_addr = ");
-						printip6(ad6->s6_addr);
-						printf("\n");
-					} else {
-						printf("      ??? not an in_addr ???\n");
-					}
-					printf("    }\n    sin6_scope_id = %d\n", in6->sin6_scope_id);
-				} else {
-					printf("    ??? not a sockaddr_in6 ???\n");
-				}
-				printf("  }\n");
+/* PTR lookup through the index, falling back to NSS. */
+int lookup_ptr(int af, const unsigned char *addr, char *ptr)
+{
+	struct hosts_entry *e;
+	if (hosts && (e = hosts_byaddr(af, addr))) {
+		entry_name(e, ptr, HOSTNAME_LEN);
+		return 0;
+	}
+	return reverse_addr(af, addr, ptr);
+}
 
-				/* use new getnameinfo */
-				memset((void*)hostname, 0, NI_MAXHOST);
-				error = getnameinfo(res->ai_addr, res->ai_addrlen, hostname, NI_MAXHOST, NULL, 0, 0);
-				if (error != 0) {
-					fprintf(stderr, "error in getnameinfo: %s\n", gai_strerror(error));
-				}
-				if (*hostname)
-					printf("  getnameinfo(ai_addr)\n    hostname: %s\n", hostname);
-			}
+/* resolve() from the index; returns 0 on a miss. */
+int hosts_resolve(const char *name, int flags, struct resolution *r)
+{
+	unsigned int found[MAX_ADDRS];
+	struct hosts_entry *e;
+	int i, n;
 
-			if (res->ai_next) {
-				printf(">\n");
-			} else {
-				printf(".\n");
+	if (!(n = hosts_byname(name, found, MAX_ADDRS))) {
+		return 0;
+	}
+	if (flags & RESOLVE_LEGACY) {
+		r->h_error = HOST_NOT_FOUND;
+		for (i = 0; i < n; i++) {
+			if (hosts->entries[found[i]].family == AF_INET) {
+				entry_name(&hosts->entries[found[i]], r->h_name, HOSTNAME_LEN);
+				r->h_error = 0;
+				break;
 			}
+		}
+	}
+	if (!(flags & RESOLVE_MODERN)) {
+		return 1;
+	}
+	entry_name(&hosts->entries[found[0]], r->canon, HOSTNAME_LEN);
+	for (i = 0; i < n; i++) {
+		e = &hosts->entries[found[i]];
+		add_raw_address(r, e->family, e->addr);
+	}
+	if (flags & RESOLVE_REVERSE) {
+		for (i = 0; i < r->naddrs; i++) {
+			lookup_ptr(r->addrs[i].family, r->addrs[i].addr, r->addrs[i].ptr);
+		}
+	}
+	return 1;
+}
+
+/*
+ * getaddrinfo() from the index, in the same shape: one result per
+ * address and socket type, with the canonical name on the first.
+ * Returns EAI_NONAME on a miss; free with hosts_freeaddrinfo().
+ */
+int hosts_getaddrinfo(const char *name, const struct addrinfo *hints, struct addrinfo **result)
+{
+	static const int types[3][2] = {
+		{ SOCK_STREAM, IPPROTO_TCP }, { SOCK_DGRAM, IPPROTO_UDP }, { SOCK_RAW, 0 }
+	};
+	unsigned int found[MAX_ADDRS];
+	struct hosts_entry *e;
+	struct addrinfo *ai, **tail = result;
+	struct sockaddr_storage *ss;
+	int i, t, n;
 
+	*result = NULL;
+	if (!hosts || !(n = hosts_byname(name, found, MAX_ADDRS))) {
+		return EAI_NONAME;
+	}
+	for (i = 0; i < n; i++) {
+		e = &hosts->entries[found[i]];
+		if (hints->ai_family != AF_UNSPEC && hints->ai_family != e->family) continue;
+		for (t = 0; t < 3; t++) {
+			if (hints->ai_socktype && hints->ai_socktype != types[t][0]) continue;
+			if (!(ai = calloc(1, sizeof(*ai) + sizeof(*ss)))) return EAI_MEMORY;
+			ss = (struct sockaddr_storage*)(ai + 1);
+			ai->ai_flags = hints->ai_flags;
+			ai->ai_family = e->family;
+			ai->ai_socktype = types[t][0];
+			ai->ai_protocol = types[t][1];
+			ai->ai_addrlen = make_sockaddr(e->family, e->addr, 0, ss);
+			ai->ai_addr = (struct sockaddr*)ss;
+			if (!*result && (hints->ai_flags & AI_CANONNAME)) {
+				ai->ai_canonname = malloc(HOSTNAME_LEN);
+				if (ai->ai_canonname) entry_name(e, ai->ai_canonname, HOSTNAME_LEN);
+			}
+			*tail = ai;
+			tail = &ai->ai_next;
 		}
+	}
+	return *result ? 0 : EAI_NONAME;
+}
 
-		freeaddrinfo(result);
-		printf("\n");
+void hosts_freeaddrinfo(struct addrinfo *result)
+{
+	struct addrinfo *next;
+	for (; result; result = next) {
+		next = result->ai_next;
+		free(result->ai_canonname);
+		free(result);
+	}
+}
+
+/*
+ * gethostbyname()/gethostbyaddr() from the index, in the same shape.
+ * Like those, the result is in static storage.  Returns NULL on a miss.
+ */
+struct hostent *hosts_hostent(const struct hosts_entry *e, const unsigned int *found, int n)
+{
+	static struct hostent he;
+	static char names[4096];
+	static char *aliases[36];	/* as glibc: up to 35 names */
+	static char addrs[MAX_ADDRS][16];
+	static char *addr_list[MAX_ADDRS + 1];
+	const char *p, *name;
+	char *q = names;
+	unsigned int len;
+	int i, a = 0;
+
+	for (p = e->names; (name = next_name(p, e->end, &len)) && a < 35; p = name + len) {
+		if (q + len + 1 > names + sizeof(names)) break;
+		memcpy(q, name, len);
+		q[len] = 0;
+		aliases[a++] = q;
+		q += len + 1;
+	}
+	he.h_name = aliases[0];
+	aliases[a] = NULL;
+	he.h_aliases = aliases + 1;
+	he.h_addrtype = e->family;
+	he.h_length = addr_len(e->family);
+	for (i = 0; i < n; i++) {
+		memcpy(addrs[i], hosts->entries[found[i]].addr, he.h_length);
+		addr_list[i] = addrs[i];
+	}
+	addr_list[n] = NULL;
+	he.h_addr_list = addr_list;
+	return &he;
+}
+
+struct hostent *hosts_gethostbyname(const char *name)
+{
+	unsigned int found[MAX_ADDRS], v4[MAX_ADDRS];
+	int i, n, n4 = 0;
+
+	if (!hosts) return NULL;
+	n = hosts_byname(name, found, MAX_ADDRS);
+	for (i = 0; i < n; i++) {
+		if (hosts->entries[found[i]].family == AF_INET) v4[n4++] = found[i];
+	}
+	return n4 ? hosts_hostent(&hosts->entries[v4[0]], v4, n4) : NULL;
+}
+
+struct hostent *hosts_gethostbyaddr(const void *addr, int af)
+{
+	struct hosts_entry *e;
+	unsigned int found;
+
+	if (!hosts || !addr_len(af) || !(e = hosts_byaddr(af, addr))) return NULL;
+	found = e - hosts->entries;
+	return hosts_hostent(e, &found, 1);
+}
+
+/* getnameinfo() from the index; returns 0 on a miss. */
+int hosts_getnameinfo(const struct sockaddr *sa, char *host, size_t len)
+{
+	struct hosts_entry *e;
+
+	if (!hosts) return 0;
+	if (sa->sa_family == AF_INET) {
+		e = hosts_byaddr(AF_INET, (const unsigned char*)&((const struct sockaddr_in*)sa)->sin_addr);
+	} else if (sa->sa_family == AF_INET6) {
+		e = hosts_byaddr(AF_INET6, ((const struct sockaddr_in6*)sa)->sin6_addr.s6_addr);
+	} else {
+		return 0;
+	}
+	if (!e) return 0;
+	entry_name(e, host, len);
+	return 1;
+}
+
+/*
+ * SPLIT LOOKUPS
+ *
+ * getaddrinfo() with AF_UNSPEC does its A and AAAA lookups one after the
+ * other; with --split they run concurrently, one per family, and the
+ * results are joined back into one list.
+ */
+
+int split_families = 0;
+int socktype = 0;	/* ai_socktype for getaddrinfo(); 0 for all */
+
+struct split_lookup {
+	const char *name;
+	struct addrinfo hints;
+	struct addrinfo *result;
+	int from_hosts;
+	int error;
+	unsigned long long ns;
+	pthread_t thread;
+};
+
+int no_such_name(int error)
+{
+	switch (error) {
+	case EAI_NONAME:
+#ifdef EAI_NODATA
+	case EAI_NODATA:
+#endif
+#ifdef EAI_ADDRFAMILY
+	case EAI_ADDRFAMILY:
+#endif
+		return 1;
+	}
+	return 0;
+}
+
+void *split_thread(void *arg)
+{
+	struct split_lookup *l = (struct split_lookup*)arg;
+	unsigned long long start = now_ns();
+	l->from_hosts = hosts_getaddrinfo(l->name, &l->hints, &l->result) == 0;
+	l->error = l->from_hosts ? 0 : getaddrinfo(l->name, NULL, &l->hints, &l->result);
+	if (l->error != 0) {
+		l->result = NULL;
+	}
+	l->ns = now_ns() - start;
+	return NULL;
+}
+
+/*
+ * getaddrinfo() for AF_INET and AF_INET6 at once.  l[0] is the AF_INET
+ * lookup and l[1] the AF_INET6; each keeps its own error and timing.
+ * The merged list must be freed with split_freeaddrinfo().
+ */
+int split_getaddrinfo(const char *name, const struct addrinfo *hints, struct split_lookup *l, struct addrinfo **result)
+{
+	struct addrinfo *res;
+	int threaded;
+
+	l[0].name = l[1].name = name;
+	l[0].hints = l[1].hints = *hints;
+	l[0].hints.ai_family = AF_INET;
+	l[1].hints.ai_family = AF_INET6;
+	/* otherwise a name with no AAAA gets its A records again, mapped */
+	l[1].hints.ai_flags &= ~AI_V4MAPPED;
+
+	threaded = pthread_create(&l[1].thread, NULL, split_thread, &l[1]) == 0;
+	split_thread(&l[0]);
+	if (threaded) {
+		pthread_join(l[1].thread, NULL);
+	} else {
+		split_thread(&l[1]);
+	}
+
+	/* AAAA first, as RFC 6724 would usually order them */
+	*result = l[1].result;
+	if (!*result) {
+		*result = l[0].result;
+	} else {
+		for (res = l[1].result; res->ai_next; res = res->ai_next) ;
+		res->ai_next = l[0].result;
+	}
+	if (*result) {
+		return 0;
+	}
+	/* a "no such name" from one family is less interesting than a failure */
+	if (no_such_name(l[0].error)) {
+		return l[1].error;
+	}
+	return l[0].error;
+}
+
+void split_freeaddrinfo(struct split_lookup *l)
+{
+	struct addrinfo *res;
+	int i;
+
+	for (res = l[1].result; res && res->ai_next; res = res->ai_next) {
+		if (res->ai_next == l[0].result) {
+			res->ai_next = NULL;
+			break;
+		}
+	}
+	for (i = 0; i < 2; i++) {
+		if (!l[i].result) continue;
+		if (l[i].from_hosts) {
+			hosts_freeaddrinfo(l[i].result);
+		} else {
+			freeaddrinfo(l[i].result);
+		}
+		l[i].result = NULL;
+	}
+}
+
+/*
+ * Thread-safe: the reentrant legacy calls are used in place of
+ * gethostbyname() and gethostbyaddr().
+ */
+void resolve(const char *name, int flags, struct resolution *r)
+{
+	struct addrinfo  hints;
+	struct addrinfo *result;
+	struct addrinfo *res;
+	struct resolved_addr *ra;
+	struct split_lookup split[2];
+	int error;
+	int i;
+
+	r->h_error = r->gai_error = r->ni_error = r->ha_error = 0;
+	r->gai_ns[0] = r->gai_ns[1] = 0;
+	r->gai_errors[0] = r->gai_errors[1] = 0;
+	r->h_name[0] = r->canon[0] = 0;
+	r->naddrs = 0;
+
+	if (hosts && hosts_resolve(name, flags, r)) {
+		return;
+	}
+	if (flags & RESOLVE_LEGACY) {
+		r->h_error = legacy_byname(name, r->h_name, NULL);
+	}
+	if (!(flags & RESOLVE_MODERN)) {
+		return;
+	}
+
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = socktype;
+	hints.ai_flags = AI_CANONNAME|AI_V4MAPPED;
+	if (split_families) {
+		r->gai_error = split_getaddrinfo(name, &hints, split, &result);
+		for (i = 0; i < 2; i++) {
+			r->gai_ns[i] = split[i].ns;
+			r->gai_errors[i] = split[i].error;
+		}
+	} else {
+		r->gai_error = getaddrinfo(name, NULL, &hints, &result);
+	}
+	if (r->gai_error != 0) {
+		return;
+	}
+	for (res = result; res != NULL; res = res->ai_next) {
+		if (res->ai_canonname && !r->canon[0]) {
+			copy_name(r->canon, res->ai_canonname);
+		}
+		add_address(r, res->ai_addr);
+	}
+	if (split_families) {
+		split_freeaddrinfo(split);
+	} else {
+		freeaddrinfo(result);
+	}
+
+	for (i = 0; i < r->naddrs; i++) {
+		ra = &r->addrs[i];
+		if (hosts && hosts_byaddr(ra->family, ra->addr)) {
+			if (flags & RESOLVE_REVERSE) {
+				lookup_ptr(ra->family, ra->addr, ra->ptr);
+			}
+			continue;
+		}
+		if (flags & RESOLVE_REVERSE) {
+			error = ra->ptr_error = reverse_addr(ra->family, ra->addr, ra->ptr);
+			if (error != 0 && r->ni_error == 0) {
+				r->ni_error = error;
+			}
+		}
+		if ((flags & RESOLVE_LEGACY) && ra->family == AF_INET) {
+			error = legacy_byaddr(ra->family, ra->addr, NULL);
+			if (error != 0 && r->ha_error == 0) {
+				r->ha_error = error;
+			}
+		}
+	}
+}
+
+/*
+ * Log-linear latency histogram, in microseconds: exact below 16us,
+ * then 16 buckets per power of two (about 6% resolution).
+ */
+#define HIST_SUB     16
+#define HIST_BUCKETS (61 * HIST_SUB)
+
+struct histogram {
+	unsigned long long count;
+	unsigned long long sum;
+	unsigned long long min;
+	unsigned long long max;
+	unsigned long bucket[HIST_BUCKETS];
+};
+
+int hist_index(unsigned long long us)
+{
+	int e;
+	if (us < HIST_SUB) return (int)us;
+	e = 63 - __builtin_clzll(us);
+	return (e - 3) * HIST_SUB + (int)((us >> (e - 4)) & (HIST_SUB - 1));
+}
+
+unsigned long long hist_value(int i)
+{
+	int e;
+	if (i < HIST_SUB) return i;
+	e = i / HIST_SUB + 3;
+	return (unsigned long long)(HIST_SUB + i % HIST_SUB) << (e - 4);
+}
+
+void hist_add(struct histogram *h, unsigned long long us)
+{
+	if (h->count == 0 || us < h->min) h->min = us;
+	if (us > h->max) h->max = us;
+	h->count ++;
+	h->sum += us;
+	h->bucket[hist_index(us)] ++;
+}
+
+void hist_merge(struct histogram *into, const struct histogram *from)
+{
+	int i;
+	if (from->count == 0) return;
+	if (into->count == 0 || from->min < into->min) into->min = from->min;
+	if (from->max > into->max) into->max = from->max;
+	into->count += from->count;
+	into->sum += from->sum;
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		into->bucket[i] += from->bucket[i];
+	}
+}
+
+unsigned long long hist_percentile(const struct histogram *h, double p)
+{
+	unsigned long long want, seen = 0;
+	int i;
+
+	want = (unsigned long long)(h->count * p / 100.0);
+	if (want >= h->count) return h->max;
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		seen += h->bucket[i];
+		if (seen > want) {
+			return hist_value(i) < h->max ? hist_value(i) : h->max;
+		}
+	}
+	return h->max;
+}
+
+void hist_print(const struct histogram *h, const char *indent)
+{
+	if (h->count == 0) {
+		printf("%s(no samples)\n", indent);
+		return;
+	}
+	printf("%smin = %llu\n", indent, h->min);
+	printf("%smean = %llu\n", indent, h->sum / h->count);
+	printf("%sp50 = %llu\n", indent, hist_percentile(h, 50.0));
+	printf("%sp90 = %llu\n", indent, hist_percentile(h, 90.0));
+	printf("%sp99 = %llu\n", indent, hist_percentile(h, 99.0));
+	printf("%sp99.9 = %llu\n", indent, hist_percentile(h, 99.9));
+	printf("%smax = %llu\n", indent, h->max);
+}
+
+int dump_name(const char *name)
+{
+	struct addrinfo  hints;
+	struct addrinfo *result;
+	struct addrinfo *res;
+	struct sockaddr_in *in;
+	struct sockaddr_in6 *in6;
+	struct hostent *host;
+	struct in_addr *ad;
+	struct in6_addr *ad6;
+	int at;
+	int error;
+	int from_hosts;
+	int i;
+	struct split_lookup split[2];
+	char hostname[NI_MAXHOST];
+	char **alias;
+
+	printf("***\n*** %s\n***\n\n", name);
+
+	/* super awesome hack bananas */
+	host = hosts_gethostbyname(name);
+	if (!host) {
+		host = gethostbyname(name);
+	}
+	if (!host) {
+		fprintf(stderr, "error in gethostbyname: %s\n", myerr(h_errno));
+	} else {
+		printf("gethostbyname()\n  hostname: %s\n", host->h_name);
+		for (alias = host->h_aliases; alias && *alias; alias++) {
+			printf("  aka: %s\n", *alias);
+		}
+	}
+
+	/* resolve the domain name into a list of addresses */
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_family = AF_UNSPEC; /* AF_INET or AF_INET6 */
+	hints.ai_socktype = socktype; /* SOCK_STREAM or SOCK_DGRAM; 0 for all */
+	hints.ai_flags = AI_CANONNAME|AI_V4MAPPED;
+#if 0
+	hints.ai_protocol = 0; /* any protocol */
+	hints.ai_canonname = NULL;
+	hints.ai_addr = NULL;
+	hints.ai_next = NULL;
+#endif
+	if (split_families) {
+		from_hosts = 0;
+		error = split_getaddrinfo(name, &hints, split, &result);
+		for (i = 0; i < 2; i++) {
+			if (split[i].error != 0) {
+				fprintf(stderr, "error in getaddrinfo(AF_%s): %s\n", family(split[i].hints.ai_family), gai_strerror(split[i].error));
+			}
+		}
+	} else {
+		from_hosts = hosts_getaddrinfo(name, &hints, &result) == 0;
+		error = from_hosts ? 0 : getaddrinfo(name, NULL, &hints, &result);
+	}
+	if (error != 0) {
+		fprintf(stderr, "error in getaddrinfo: %s\n", gai_strerror(error));
+		return EXIT_FAILURE;
+	}
+
+	printf("getaddrinfo()\n");
+	if (split_families) {
+		printf("  AF_INET: %.3f ms, AF_INET6: %.3f ms\n", split[0].ns / 1e6, split[1].ns / 1e6);
+	}
+
+	/* loop over all returned results and do inverse lookup */
+	for (res = result; res != NULL; res = res->ai_next) {
+		ad = NULL;
+
+		printf("  ai_flags = 0x%X ", res->ai_flags);
+		printflags(res->ai_flags);
+		printf("  ai_family = %d [AF_%s]\n  ai_socktype = %d [%s]\n  ai_protocol = %d [%s]\n", res->ai_family, family(res->ai_family), res->ai_socktype, stype(res->ai_socktype), res->ai_protocol, sockop(res->ai_protocol));
+		if (res->ai_canonname && *(res->ai_canonname)) {
+			printf("  ai_canonname = \"%s\"\n", res->ai_canonname);
+		} else {
+			printf("  ai_canonname = NULL\n");
+		}
+		if (res->ai_family == AF_INET) {
+			/* IPv4 */
+			printf("  ai_addr = {\n");
+			if (res->ai_addrlen == sizeof(struct sockaddr_in)) {
+				in = (struct sockaddr_in*)(res->ai_addr);
+				printf("    sin_family = %d [AF_%s]\n    sin_port = %d\n    sin_addr = {\n", in->sin_family, family(in->sin_family), in->sin_port);
+				if (sizeof(in->sin_addr) == sizeof(struct in_addr)) {
+					ad = (struct in_addr*)&(in->sin_addr);
+					at = in->sin_family;
+					printf("      s_addr = 0x%08X (%d.%d.%d.%d)\n", ad->s_addr, ad->s_addr & 0xff, (ad->s_addr >> 8) & 0xff, (ad->s_addr >> 16) & 0xff, ad->s_addr >> 24);
+				} else {
+					printf("      ??? not an in_addr ???\n");
+				}
+				printf("    }\n");
+			} else {
+				printf("    ??? not a sockaddr_in ???\n");
+			}
+			printf("  }\n");
+
+			/* use new getnameinfo */
+			memset((void*)hostname, 0, NI_MAXHOST);
+			error = hosts_getnameinfo(res->ai_addr, hostname, NI_MAXHOST) ? 0 :
+				getnameinfo(res->ai_addr, res->ai_addrlen, hostname, NI_MAXHOST, NULL, 0, 0);
+			if (error != 0) {
+				fprintf(stderr, "error in getnameinfo: %s\n", gai_strerror(error));
+			}
+			if (*hostname)
+				printf("  getnameinfo(ai_addr)\n    hostname: %s\n", hostname);
+
+			/* use old gethostbyaddr */
+			if (ad) {
+				host = hosts_gethostbyaddr(ad, at);
+				if (!host) {
+					host = gethostbyaddr(ad, sizeof(*ad), at);
+				}
+				if (!host) {
+					fprintf(stderr, "error in gethostbyaddr: %s\n", myerr(h_errno));
+				} else {
+					printf("  gethostbyaddr(ai_addr->sin_addr)\n    hostname: %s\n", host->h_name);
+					for (alias = host->h_aliases; alias && *alias; alias++) {
+						printf("  aka: %s\n", *alias);
+					}
+				}
+			}
+		} else if (res->ai_family == AF_INET6) {
+			/* IPv6 */
+			printf("  ai_addr = {\n");
+			if (res->ai_addrlen == sizeof(struct sockaddr_in6)) {
+				in6 = (struct sockaddr_in6*)(res->ai_addr);
+				printf("    sin6_family = %d [AF_%s]\n    sin6_port = %d\n    sin6_flowinfo = %d\n    sin6_addr = {\n", in6->sin6_family, family(in6->sin6_family), in6->sin6_port, in6->sin6_flowinfo);
+				if (sizeof(in6->sin6_addr) == sizeof(struct in6_addr)) {
+					ad6 = (struct in6_addr*)&(in6->sin6_addr);
+					printf("      s6_addr = ");
+					printip6(ad6->s6_addr);
+					printf("\n");
+				} else {
+					printf("      ??? not an in_addr ???\n");
+				}
+				printf("    }\n    sin6_scope_id = %d\n", in6->sin6_scope_id);
+			} else {
+				printf("    ??? not a sockaddr_in6 ???\n");
+			}
+			printf("  }\n");
+
+			/* use new getnameinfo */
+			memset((void*)hostname, 0, NI_MAXHOST);
+			error = hosts_getnameinfo(res->ai_addr, hostname, NI_MAXHOST) ? 0 :
+				getnameinfo(res->ai_addr, res->ai_addrlen, hostname, NI_MAXHOST, NULL, 0, 0);
+			if (error != 0) {
+				fprintf(stderr, "error in getnameinfo: %s\n", gai_strerror(error));
+			}
+			if (*hostname)
+				printf("  getnameinfo(ai_addr)\n    hostname: %s\n", hostname);
+		}
+
+		if (res->ai_next) {
+			printf(">\n");
+		} else {
+			printf(".\n");
+		}
+
+	}
+
+	if (split_families) {
+		split_freeaddrinfo(split);
+	} else if (from_hosts) {
+		hosts_freeaddrinfo(result);
+	} else {
+		freeaddrinfo(result);
+	}
+	printf("\n");
+	return EXIT_SUCCESS;
+}
+
+/* OPTIONS */
+int bench = 0;
+int batch = 0;
+int query_rate = 0;		/* target queries per second; 0 = unlimited */
+int concurrency = 0;	/* worker threads; 0 = default */
+int bench_duration = 10;	/* seconds */
+int watch_interval = 0;		/* seconds; 0 = no --watch */
+int watch_count = 0;		/* cycles; 0 = forever */
+int probe_port = 0;		/* 0 = no --probe */
+int probe_timeout = 3000;	/* milliseconds */
+const char *enrich_path = NULL;
+int compare = 0;
+int lookup_flags = RESOLVE_ALL;
+const char *hosts_path = NULL;
+
+const char **sweeps = NULL;
+int nsweeps = 0;
+
+const char **names = NULL;
+int nnames = 0;
+
+void add_name(const char *name)
+{
+	const char **tmp;
+	if (!(nnames & (nnames - 1))) {
+		tmp = realloc(names, (nnames ? nnames * 2 : 1) * sizeof(*names));
+		if (!tmp) {
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+		names = tmp;
+	}
+	names[nnames++] = name;
+}
+
+/* one name per line; blank lines and #comments are skipped */
+void load_names(const char *path)
+{
+	FILE *fp;
+	char line[1024];
+	char *p, *end;
+
+	if (strcmp(path, "-") == 0) {
+		fp = stdin;
+	} else if (!(fp = fopen(path, "r"))) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	while (fgets(line, sizeof(line), fp)) {
+		for (p = line; *p == ' ' || *p == '\t'; p++) ;
+		for (end = p; *end && *end != '#' && *end != ' ' && *end != '\t' && *end != '\r' && *end != '\n'; end++) ;
+		if (end == p) continue;
+		*end = 0;
+		add_name(strdup(p));
+	}
+	if (fp != stdin) {
+		fclose(fp);
+	}
+}
+
+/*
+ * SNAPSHOT
+ *
+ * Results from one --batch run, kept for the next.  The file is mapped
+ * and used in place: a header, then fixed-size entry and address records,
+ * a hash table over the names, and a table of NUL-terminated strings.
+ * Nothing is parsed at startup, so a million entries cost no more to
+ * open than ten.  It is written in native byte order; a file from a
+ * different architecture (or version) is ignored, not misread.
+ */
+
+#define SNAPSHOT_MAGIC   "hlsnap\r\n"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_ORDER   0x01020304
+
+struct snapshot_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t nentries;
+	uint32_t naddrs;
+	uint32_t nslots;	/* power of two */
+	uint32_t reserved;
+	uint64_t strings_size;
+};
+
+struct snapshot_entry {
+	uint32_t name;		/* offsets into the string table */
+	uint32_t canon;
+	uint32_t h_name;
+	uint32_t addrs;		/* index of the first address */
+	uint16_t naddrs;
+	uint16_t flags;		/* the RESOLVE_* lookups it was resolved with */
+	uint32_t ttl;		/* seconds */
+	int64_t resolved;	/* time_t */
+};
+
+struct snapshot_addr {
+	uint32_t ptr;
+	uint8_t family;
+	uint8_t pad[3];
+	unsigned char addr[16];
+};
+
+struct snapshot {
+	void *map;
+	size_t size;
+	const struct snapshot_header *header;
+	const struct snapshot_entry *entries;
+	const struct snapshot_addr *addrs;
+	const uint32_t *slots;	/* entry + 1, or 0 if empty */
+	const char *strings;
+};
+
+const char *snapshot_path = NULL;
+int snapshot_ttl = 3600;	/* seconds */
+
+/* Maps an existing snapshot; a missing or unusable file is just empty. */
+/*
+ * Maps the snapshot at path, if there is a usable one.  Returns -1 if
+ * path is something that isn't ours to replace: anything but an absent
+ * or empty file, or one that starts with the magic (an older version, or
+ * another byte order, is replaced).
+ */
+int snapshot_open(const char *path, struct snapshot *s)
+{
+	const struct snapshot_header *h;
+	struct stat sb;
+	char magic[8];
+	size_t want;
+	int fd;
+
+	memset(s, 0, sizeof(*s));
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		if (errno == ENOENT) return 0;
+		perror(path);
+		return -1;
+	}
+	if (fstat(fd, &sb) < 0) {
+		perror(path);
+		close(fd);
+		return -1;
+	}
+	if (!S_ISREG(sb.st_mode) || (sb.st_size > 0 &&
+	    (pread(fd, magic, 8, 0) != 8 || memcmp(magic, SNAPSHOT_MAGIC, 8) != 0))) {
+		fprintf(stderr, "%s: exists and is not a snapshot; not replacing it\n", path);
+		close(fd);
+		return -1;
+	}
+	if ((size_t)sb.st_size < sizeof(*h)) {
+		close(fd);
+		return 0;
+	}
+	s->map = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (s->map == MAP_FAILED) {
+		perror(path);
+		s->map = NULL;
+		return -1;
+	}
+	s->size = sb.st_size;
+	h = s->header = (const struct snapshot_header*)s->map;
+
+	want = sizeof(*h) + (size_t)h->nentries * sizeof(struct snapshot_entry)
+		+ (size_t)h->naddrs * sizeof(struct snapshot_addr)
+		+ (size_t)h->nslots * sizeof(uint32_t) + h->strings_size;
+	if (memcmp(h->magic, SNAPSHOT_MAGIC, 8) != 0 || h->version != SNAPSHOT_VERSION ||
+	    h->byte_order != SNAPSHOT_ORDER || want != s->size || h->strings_size == 0 ||
+	    !h->nslots || (h->nslots & (h->nslots - 1)) || h->nslots <= h->nentries ||
+	    ((const char*)s->map)[s->size - 1] != 0) {
+		/* room for an empty slot, and a NUL ending the strings (which end
+		 * the file), keep snapshot_find() short and within the mapping */
+		fprintf(stderr, "%s: not a usable snapshot; ignoring it\n", path);
+		munmap(s->map, s->size);
+		memset(s, 0, sizeof(*s));
+		return 0;
+	}
+	s->entries = (const struct snapshot_entry*)(h + 1);
+	s->addrs = (const struct snapshot_addr*)(s->entries + h->nentries);
+	s->slots = (const uint32_t*)(s->addrs + h->naddrs);
+	s->strings = (const char*)(s->slots + h->nslots);
+	return 0;
+}
+
+void snapshot_close(struct snapshot *s)
+{
+	if (s->map) {
+		munmap(s->map, s->size);
+	}
+	memset(s, 0, sizeof(*s));
+}
+
+const char *snapshot_string(const struct snapshot *s, uint32_t off)
+{
+	return off < s->header->strings_size ? s->strings + off : "";
+}
+
+/* Returns the index of the entry for a name, or -1. */
+long snapshot_find(const struct snapshot *s, const char *name)
+{
+	uint32_t i, j, k, mask;
+	if (!s->map) return -1;
+	mask = s->header->nslots - 1;
+	j = hash_name(name, strlen(name));
+	for (i = 0; i <= mask && (k = s->slots[(j + i) & mask]); i++) {
+		if (k <= s->header->nentries && strcasecmp(snapshot_string(s, s->entries[k - 1].name), name) == 0) {
+			return k - 1;
+		}
+	}
+	return -1;
+}
+
+int snapshot_fresh(const struct snapshot_entry *e, time_t now)
+{
+	return (e->flags & lookup_flags) == lookup_flags && now >= e->resolved && now < e->resolved + (int64_t)e->ttl;
+}
+
+void snapshot_load(const struct snapshot *s, long i, struct resolution *r)
+{
+	const struct snapshot_entry *e = &s->entries[i];
+	const struct snapshot_addr *a;
+	int k;
+
+	r->h_error = r->gai_error = r->ni_error = r->ha_error = 0;
+	r->gai_ns[0] = r->gai_ns[1] = 0;
+	r->gai_errors[0] = r->gai_errors[1] = 0;
+	copy_name(r->canon, snapshot_string(s, e->canon));
+	copy_name(r->h_name, snapshot_string(s, e->h_name));
+	r->naddrs = 0;
+	for (k = 0; k < e->naddrs && k < MAX_ADDRS && e->addrs + k < s->header->naddrs; k++) {
+		a = &s->addrs[e->addrs + k];
+		r->addrs[k].family = a->family;
+		memcpy(r->addrs[k].addr, a->addr, 16);
+		copy_name(r->addrs[k].ptr, snapshot_string(s, a->ptr));
+		r->naddrs ++;
+	}
+}
+
+/* growable buffer for building the next snapshot */
+struct buffer {
+	char *data;
+	size_t len;
+	size_t cap;
+};
+
+void *buffer_add(struct buffer *b, const void *data, size_t len)
+{
+	char *tmp;
+	size_t cap = b->cap ? b->cap : 4096;
+	while (cap < b->len + len) cap *= 2;
+	if (cap != b->cap) {
+		if (!(tmp = realloc(b->data, cap))) {
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+		b->data = tmp;
+		b->cap = cap;
+	}
+	memcpy(b->data + b->len, data, len);
+	b->len += len;
+	return b->data + b->len - len;
+}
+
+uint32_t add_string(struct buffer *strings, const char *str)
+{
+	uint32_t off;
+	if (!*str) return 0;	/* the table starts with "" */
+	off = strings->len;
+	buffer_add(strings, str, strlen(str) + 1);
+	return off;
+}
+
+struct snapshot_writer {
+	struct buffer entries;
+	struct buffer addrs;
+	struct buffer strings;
+	uint32_t nentries;
+	uint32_t *index;	/* entry + 1, by name */
+	uint32_t nindex;
+};
+
+/*
+ * Claims name for the entry about to be added; returns 0 if it was
+ * already written, so a name repeated in the input is written once.
+ */
+int writer_claim(struct snapshot_writer *w, const char *name)
+{
+	const struct snapshot_entry *entries = (const struct snapshot_entry*)w->entries.data;
+	const char *other;
+	uint32_t *index, nindex, i, j, k;
+
+	if ((w->nentries + 1) * 2 > w->nindex) {
+		nindex = table_size(w->nentries + 1) * 2;
+		if (!(index = calloc(nindex, sizeof(*index)))) {
+			perror("calloc");
+			exit(EXIT_FAILURE);
+		}
+		for (i = 0; i < w->nentries; i++) {
+			other = w->strings.data + entries[i].name;
+			for (j = hash_name(other, strlen(other)); index[j & (nindex - 1)]; j++) ;
+			index[j & (nindex - 1)] = i + 1;
+		}
+		free(w->index);
+		w->index = index;
+		w->nindex = nindex;
+	}
+	for (j = hash_name(name, strlen(name)); (k = w->index[j & (w->nindex - 1)]); j++) {
+		if (strcasecmp(w->strings.data + entries[k - 1].name, name) == 0) {
+			return 0;
+		}
+	}
+	w->index[j & (w->nindex - 1)] = w->nentries + 1;
+	return 1;
+}
+
+void writer_add(struct snapshot_writer *w, const char *name, const struct resolution *r, int64_t resolved, uint32_t ttl, int flags)
+{
+	struct snapshot_entry e;
+	struct snapshot_addr a;
+	int k;
+
+	if (!writer_claim(w, name)) {
+		return;
+	}
+	memset(&e, 0, sizeof(e));
+	e.name = add_string(&w->strings, name);
+	e.canon = add_string(&w->strings, r->canon);
+	e.h_name = add_string(&w->strings, r->h_name);
+	e.addrs = w->addrs.len / sizeof(a);
+	e.naddrs = r->naddrs;
+	e.flags = flags;
+	e.ttl = ttl;
+	e.resolved = resolved;
+	for (k = 0; k < r->naddrs; k++) {
+		memset(&a, 0, sizeof(a));
+		a.family = r->addrs[k].family;
+		memcpy(a.addr, r->addrs[k].addr, 16);
+		a.ptr = add_string(&w->strings, r->addrs[k].ptr);
+		buffer_add(&w->addrs, &a, sizeof(a));
+	}
+	buffer_add(&w->entries, &e, sizeof(e));
+	w->nentries ++;
+}
+
+/* Writes the snapshot to a temporary file and renames it into place. */
+int writer_save(struct snapshot_writer *w, const char *path)
+{
+	struct snapshot_header h;
+	struct snapshot_entry *entries = (struct snapshot_entry*)w->entries.data;
+	uint32_t *slots;
+	uint32_t i, j;
+	char *tmp;
+	FILE *fp;
+	int ok;
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, SNAPSHOT_MAGIC, 8);
+	h.version = SNAPSHOT_VERSION;
+	h.byte_order = SNAPSHOT_ORDER;
+	h.nentries = w->nentries;
+	h.naddrs = w->addrs.len / sizeof(struct snapshot_addr);
+	h.nslots = table_size(w->nentries);
+	h.strings_size = w->strings.len;
+
+	if (!(slots = calloc(h.nslots, sizeof(*slots)))) {
+		perror("calloc");
+		return -1;
+	}
+	for (i = 0; i < w->nentries; i++) {
+		const char *name = w->strings.data + entries[i].name;
+		for (j = hash_name(name, strlen(name)); slots[j & (h.nslots - 1)]; j++) ;
+		slots[j & (h.nslots - 1)] = i + 1;
+	}
+
+	if (!(tmp = malloc(strlen(path) + 16))) {
+		perror("malloc");
+		return -1;
+	}
+	sprintf(tmp, "%s.%d.tmp", path, (int)getpid());
+	if (!(fp = fopen(tmp, "wb"))) {
+		perror(tmp);
+		free(tmp);
+		free(slots);
+		return -1;
+	}
+	ok = fwrite(&h, sizeof(h), 1, fp) == 1
+		&& fwrite(w->entries.data, 1, w->entries.len, fp) == w->entries.len
+		&& fwrite(w->addrs.data, 1, w->addrs.len, fp) == w->addrs.len
+		&& fwrite(slots, sizeof(*slots), h.nslots, fp) == h.nslots
+		&& fwrite(w->strings.data, 1, w->strings.len, fp) == w->strings.len
+		&& fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+	if (fclose(fp) != 0) ok = 0;
+	if (!ok || rename(tmp, path) != 0) {
+		perror(tmp);
+		unlink(tmp);
+		ok = 0;
+	}
+	free(tmp);
+	free(slots);
+	return ok ? 0 : -1;
+}
+
+/*
+ * BATCH
+ *
+ * resolve_batch() runs the lookups on a pool of --concurrency threads, but
+ * only lets a window of them be in flight at once.  A transient failure
+ * (TRY_AGAIN or EAI_AGAIN) halves the window, at most once per window's
+ * worth of lookups, and the name is retried after an exponential backoff
+ * with jitter; each success grows the window by 1/window.  Below a
+ * window of one, a further failure instead spaces out admissions (new
+ * names and retries alike) by a gap that doubles, and each success
+ * takes a thirty-second off it.  A resolver that throttles thus gets the
+ * most load it will take, and no more, even if it fails fast.
+ */
+
+int retries = 3;
+int backoff_ms = 100;
+
+#define PACE_START_NS 1000000ULL	/* first gap: 1000 lookups/s */
+#define PACE_MAX_NS   1000000000ULL
+
+struct retry {
+	unsigned long long due;
+	int index;
+	int attempt;
+};
+
+struct scheduler {
+	double window;
+	double min_window;
+	unsigned long long gap;		/* between admissions, once window is 1 */
+	unsigned long long max_gap;
+	unsigned long long next_start;
+	unsigned long long last_cut;
+	unsigned long transient;
+	unsigned long retried;
+	unsigned long gave_up;
+};
+
+/* carried from one resolve_batch() to the next */
+struct scheduler sched = { 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+struct batch {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	const char **names;
+	struct resolution *results;
+	int n;
+	int next;		/* next name not yet tried */
+	int remaining;		/* names not yet finished */
+	int inflight;
+	int max;
+	struct retry *heap;	/* pending retries, earliest first */
+	int nheap;
+};
+
+void heap_push(struct batch *b, struct retry r)
+{
+	int i = b->nheap++, parent;
+	while (i > 0 && b->heap[parent = (i - 1) / 2].due > r.due) {
+		b->heap[i] = b->heap[parent];
+		i = parent;
+	}
+	b->heap[i] = r;
+}
+
+struct retry heap_pop(struct batch *b)
+{
+	struct retry top = b->heap[0], last = b->heap[--b->nheap];
+	int i = 0, child;
+	while ((child = 2 * i + 1) < b->nheap) {
+		if (child + 1 < b->nheap && b->heap[child + 1].due < b->heap[child].due) child++;
+		if (last.due <= b->heap[child].due) break;
+		b->heap[i] = b->heap[child];
+		i = child;
+	}
+	b->heap[i] = last;
+	return top;
+}
+
+int transient(const struct resolution *r)
+{
+	return r->gai_error == EAI_AGAIN || r->h_error == TRY_AGAIN || r->ni_error == EAI_AGAIN;
+}
+
+/* half the exponential delay, plus up to as much again at random */
+unsigned long long backoff(int attempt, unsigned int *seed)
+{
+	unsigned long long ms = (unsigned long long)backoff_ms << (attempt < 16 ? attempt - 1 : 15);
+	ms = ms / 2 + rand_r(seed) % (ms / 2 + 1);
+	return ms * 1000000ULL;
+}
+
+void wait_until(struct batch *b, unsigned long long due)
+{
+	struct timespec ts;
+	ts.tv_sec = due / 1000000000ULL;
+	ts.tv_nsec = due % 1000000000ULL;
+	pthread_cond_timedwait(&b->cond, &b->lock, &ts);
+}
+
+void *batch_thread(void *arg)
+{
+	struct batch *b = (struct batch*)arg;
+	struct retry job;
+	unsigned int seed = (unsigned int)now_ns() ^ (unsigned int)(size_t)&job;
+	unsigned long long start, t;
+
+	pthread_mutex_lock(&b->lock);
+	while (b->remaining > 0) {
+		t = now_ns();
+		if (b->inflight >= (int)sched.window) {
+			pthread_cond_wait(&b->cond, &b->lock);
+			continue;
+		}
+		if (sched.gap && t < sched.next_start) {
+			wait_until(b, sched.next_start);
+			continue;
+		}
+		if (b->nheap && b->heap[0].due <= t) {
+			job = heap_pop(b);
+		} else if (b->next < b->n) {
+			job.index = b->next++;
+			job.attempt = 0;
+		} else {
+			if (b->nheap) {
+				wait_until(b, b->heap[0].due);
+			} else {
+				pthread_cond_wait(&b->cond, &b->lock);
+			}
+			continue;
+		}
+
+		b->inflight ++;
+		sched.next_start = t + sched.gap;
+		pthread_mutex_unlock(&b->lock);
+		start = now_ns();
+		resolve(b->names[job.index], lookup_flags, &b->results[job.index]);
+		pthread_mutex_lock(&b->lock);
+		b->inflight --;
+
+		if (transient(&b->results[job.index])) {
+			sched.transient ++;
+			if (start >= sched.last_cut) {
+				/* only lookups started since the last cut count against it */
+				if (sched.window > 1) {
+					sched.window = sched.window / 2 < 1 ? 1 : sched.window / 2;
+				} else {
+					sched.gap = sched.gap ? sched.gap * 2 : PACE_START_NS;
+					if (sched.gap > PACE_MAX_NS) sched.gap = PACE_MAX_NS;
+					if (sched.gap > sched.max_gap) sched.max_gap = sched.gap;
+				}
+				sched.last_cut = now_ns();
+				if (sched.window < sched.min_window) sched.min_window = sched.window;
+			}
+			if (job.attempt < retries) {
+				job.attempt ++;
+				job.due = now_ns() + backoff(job.attempt, &seed);
+				heap_push(b, job);
+				sched.retried ++;
+				pthread_cond_broadcast(&b->cond);
+				continue;
+			}
+			sched.gave_up ++;
+		} else if (sched.gap) {
+			sched.gap -= sched.gap / 32;
+			if (sched.gap < PACE_START_NS / 64) sched.gap = 0;	/* back to the window */
+		} else {
+			sched.window += 1.0 / sched.window;
+			if (sched.window > b->max) sched.window = b->max;
+		}
+		b->remaining --;
+		pthread_cond_broadcast(&b->cond);
+	}
+	pthread_mutex_unlock(&b->lock);
+	return NULL;
+}
+
+/* resolve() each name into results[], retrying transient failures. */
+int resolve_batch(const char **list, int n, struct resolution *results)
+{
+	struct batch b;
+	pthread_condattr_t attr;
+	pthread_t *threads;
+	int nthreads, i;
+
+	if (n == 0) {
+		return 0;
+	}
+	memset(&b, 0, sizeof(b));
+	b.names = list;
+	b.results = results;
+	b.n = b.remaining = n;
+	b.max = concurrency ? concurrency : 8;
+	if (sched.window == 0 || sched.window > b.max) {
+		sched.window = sched.min_window = b.max;
+	}
+	if (!(b.heap = calloc(n, sizeof(*b.heap)))) {
+		perror("calloc");
+		return -1;
+	}
+	pthread_mutex_init(&b.lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&b.cond, &attr);
+
+	nthreads = b.max < n ? b.max : n;
+	if (!(threads = calloc(nthreads, sizeof(*threads)))) {
+		perror("calloc");
+		return -1;
+	}
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&threads[i], NULL, batch_thread, &b) != 0) {
+			perror("pthread_create");
+			nthreads = i;
+			break;
+		}
+	}
+	if (nthreads == 0) {
+		batch_thread(&b);
+	}
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	pthread_cond_destroy(&b.cond);
+	pthread_condattr_destroy(&attr);
+	pthread_mutex_destroy(&b.lock);
+	free(threads);
+	free(b.heap);
+	return 0;
+}
+
+/* NAME <tab> CANONNAME <tab> ADDRESS[=PTR] ... */
+void print_result(FILE *fp, const char *name, const struct resolution *r)
+{
+	char text[INET6_ADDRSTRLEN];
+	int i;
+
+	if (r->gai_error) {
+		fprintf(fp, "%s\t!%s\n", name, gai_strerror(r->gai_error));
+		return;
+	}
+	fprintf(fp, "%s\t%s\t", name, r->canon);
+	for (i = 0; i < r->naddrs; i++) {
+		format_addr(r->addrs[i].family, r->addrs[i].addr, text, sizeof(text));
+		fprintf(fp, "%s%s", i ? " " : "", text);
+		if (*r->addrs[i].ptr) {
+			fprintf(fp, "=%s", r->addrs[i].ptr);
+		}
+	}
+	fprintf(fp, "\n");
+}
+
+/*
+ * With --snapshot, names with a fresh entry are answered from it and only
+ * the rest are resolved.  The new snapshot holds this run's results plus
+ * any other entries that have not yet expired.  Names are taken a chunk
+ * at a time, so memory use doesn't grow with the length of the list.
+ */
+#define BATCH_CHUNK 1024
+
+int run_batch(void)
+{
+	struct snapshot snap;
+	struct snapshot_writer w;
+	struct resolution *cached, *fresh, *r;
+	const struct snapshot_entry *e;
+	const char **stale;
+	long entry[BATCH_CHUNK];	/* each name's snapshot entry, or -1 */
+	int slot[BATCH_CHUNK];		/* each name's index into cached[] or fresh[] */
+	unsigned char *used;
+	time_t now = time(NULL);
+	int ncached, nstale;
+	long total_cached = 0;
+	int base, n, i;
+	long k;
+
+	memset(&snap, 0, sizeof(snap));
+	memset(&w, 0, sizeof(w));
+	if (snapshot_path) {
+		if (snapshot_open(snapshot_path, &snap) != 0) {
+			return EXIT_FAILURE;
+		}
+		buffer_add(&w.strings, "", 1);
+	}
+	cached = calloc(BATCH_CHUNK, sizeof(*cached));
+	fresh = calloc(BATCH_CHUNK, sizeof(*fresh));
+	stale = calloc(BATCH_CHUNK, sizeof(*stale));
+	used = calloc(snap.map ? snap.header->nentries + 1 : 1, 1);
+	if (!cached || !fresh || !stale || !used) {
+		perror("calloc");
+		return EXIT_FAILURE;
+	}
+
+	for (base = 0; base < nnames; base += BATCH_CHUNK) {
+		n = nnames - base < BATCH_CHUNK ? nnames - base : BATCH_CHUNK;
+		ncached = nstale = 0;
+		for (i = 0; i < n; i++) {
+			entry[i] = k = snapshot_find(&snap, names[base + i]);
+			if (k >= 0) {
+				used[k] = 1;
+				if (snapshot_fresh(&snap.entries[k], now)) {
+					snapshot_load(&snap, k, &cached[ncached]);
+					slot[i] = ncached++;
+					continue;
+				}
+			}
+			stale[nstale] = names[base + i];
+			slot[i] = nstale++;
+			entry[i] = -1;
+		}
+		resolve_batch(stale, nstale, fresh);
+		total_cached += ncached;
+
+		for (i = 0; i < n; i++) {
+			r = entry[i] >= 0 ? &cached[slot[i]] : &fresh[slot[i]];
+			print_result(stdout, names[base + i], r);
+			if (!snapshot_path) {
+				continue;
+			}
+			if (entry[i] >= 0) {
+				e = &snap.entries[entry[i]];
+				writer_add(&w, names[base + i], r, e->resolved, e->ttl, e->flags);
+			} else if (!r->gai_error) {
+				writer_add(&w, names[base + i], r, now, snapshot_ttl, lookup_flags);
+			}
+		}
+	}
+	fflush(stdout);
+
+	if (sched.transient) {
+		fprintf(stderr, "%lu transient failures: %lu retried, %lu gave up; window %.1f, lowest %.1f\n",
+			sched.transient, sched.retried, sched.gave_up, sched.window, sched.min_window);
+	}
+	if (sched.max_gap) {
+		fprintf(stderr, "paced to one lookup every %.1f ms, slowest %.1f ms\n", sched.gap / 1e6, sched.max_gap / 1e6);
+	}
+	if (snapshot_path) {
+		fprintf(stderr, "%d names: %ld from snapshot, %ld resolved\n", nnames, total_cached, nnames - total_cached);
+		for (k = 0; snap.map && k < snap.header->nentries; k++) {
+			e = &snap.entries[k];
+			if (!used[k] && now < e->resolved + (int64_t)e->ttl) {
+				snapshot_load(&snap, k, cached);
+				writer_add(&w, snapshot_string(&snap, e->name), cached, e->resolved, e->ttl, e->flags);
+			}
+		}
+		snapshot_close(&snap);
+		if (writer_save(&w, snapshot_path) != 0) {
+			return EXIT_FAILURE;
+		}
+		free(w.entries.data);
+		free(w.addrs.data);
+		free(w.strings.data);
+		free(w.index);
+	}
+
+	free(used);
+	free(stale);
+	free(fresh);
+	free(cached);
+	return EXIT_SUCCESS;
+}
+
+/*
+ * LOOKUP SERVICE
+ *
+ * --serve answers lookups over a UNIX domain socket: the client sends a
+ * name per line, and gets back a line in the --batch format.  Identical
+ * lookups that arrive while one is already in flight wait for its result
+ * instead of making their own (single-flight), so N processes asking
+ * for the same name at once cost one upstream lookup.
+ */
+
+#define FLIGHT_BUCKETS 256
+
+struct flight {
+	struct flight *next;
+	char name[HOSTNAME_LEN];
+	int waiters;
+	int done;
+	struct resolution result;
+};
+
+struct flight *flights[FLIGHT_BUCKETS];
+pthread_mutex_t flight_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t flight_done = PTHREAD_COND_INITIALIZER;
+unsigned long served = 0;	/* requests answered */
+unsigned long upstream = 0;	/* lookups actually made */
+
+const char *serve_path = NULL;
+const char *client_path = NULL;
+volatile sig_atomic_t stopping = 0;
+
+/*
+ * resolve(), with the --hosts index rebuilt if the file has changed, at
+ * most once a second.  Lookups hold the index for reading; the swap waits
+ * for them to finish.
+ */
+pthread_rwlock_t hosts_lock = PTHREAD_RWLOCK_INITIALIZER;
+pthread_mutex_t reload_lock = PTHREAD_MUTEX_INITIALIZER;
+unsigned long long reload_checked = 0;
+
+void serve_resolve(const char *name, struct resolution *r)
+{
+	struct hosts_index *fresh = NULL, *old;
+	unsigned long long t = now_ns();
+
+	pthread_mutex_lock(&reload_lock);
+	if (t - reload_checked >= 1000000000ULL) {
+		reload_checked = t;
+		fresh = hosts_reload();	/* only this thread can be changing hosts */
+	}
+	if (fresh) {
+		pthread_rwlock_wrlock(&hosts_lock);
+		old = hosts;
+		hosts = fresh;
+		pthread_rwlock_unlock(&hosts_lock);
+		hosts_close(old);
+	}
+	pthread_mutex_unlock(&reload_lock);
+
+	pthread_rwlock_rdlock(&hosts_lock);
+	resolve(name, lookup_flags, r);
+	pthread_rwlock_unlock(&hosts_lock);
+}
+
+void coalesced_resolve(const char *name, struct resolution *r)
+{
+	struct flight **p, *f;
+	unsigned int bucket = hash_name(name, strlen(name)) % FLIGHT_BUCKETS;
+
+	pthread_mutex_lock(&flight_lock);
+	for (f = flights[bucket]; f; f = f->next) {
+		if (strcasecmp(f->name, name) == 0) break;
+	}
+	if (f) {
+		f->waiters ++;
+		while (!f->done) {
+			pthread_cond_wait(&flight_done, &flight_lock);
+		}
+	} else if ((f = malloc(sizeof(*f)))) {
+		copy_name(f->name, name);
+		f->waiters = 1;
+		f->done = 0;
+		f->next = flights[bucket];
+		flights[bucket] = f;
+		upstream ++;
+		pthread_mutex_unlock(&flight_lock);
+
+		serve_resolve(name, &f->result);
+
+		pthread_mutex_lock(&flight_lock);
+		f->done = 1;
+		pthread_cond_broadcast(&flight_done);
+	} else {
+		/* out of memory: just look it up */
+		upstream ++;
+		pthread_mutex_unlock(&flight_lock);
+		serve_resolve(name, r);
+		pthread_mutex_lock(&flight_lock);
+		served ++;
+		pthread_mutex_unlock(&flight_lock);
+		return;
+	}
+
+	*r = f->result;
+	served ++;
+	if (--f->waiters == 0) {
+		for (p = &flights[bucket]; *p != f; p = &(*p)->next) ;
+		*p = f->next;
+		free(f);
+	}
+	pthread_mutex_unlock(&flight_lock);
+}
+
+void strip_line(char *line)
+{
+	size_t len = strlen(line);
+	while (len && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+		line[--len] = 0;
+	}
+}
+
+void *serve_thread(void *arg)
+{
+	int fd = (int)(size_t)arg;
+	struct resolution *r;
+	char line[HOSTNAME_LEN + 2];
+	FILE *in, *out;
+	int c;
+
+	in = fdopen(fd, "r");
+	out = fdopen(dup(fd), "w");
+	r = malloc(sizeof(*r));
+	if (!in || !out || !r) {
+		perror("serve");
+		close(fd);
+		return NULL;
+	}
+	while (fgets(line, sizeof(line), in)) {
+		if (strlen(line) == sizeof(line) - 1 && line[sizeof(line) - 2] != '\n') {
+			/* too long to be a name: one answer for the whole line */
+			while ((c = getc(in)) != EOF && c != '\n') ;
+			fprintf(out, "\t!Name too long\n");
+			fflush(out);
+			continue;
+		}
+		strip_line(line);
+		if (!*line) continue;
+		if (strcmp(line, "!stats") == 0) {
+			pthread_mutex_lock(&flight_lock);
+			fprintf(out, "!stats\t%lu\t%lu\n", served, upstream);
+			pthread_mutex_unlock(&flight_lock);
+		} else {
+			coalesced_resolve(line, r);
+			print_result(out, line, r);
+		}
+		fflush(out);
+	}
+	free(r);
+	fclose(out);
+	fclose(in);
+	return NULL;
+}
+
+void stop_serving(int sig)
+{
+	(void)sig;
+	stopping = 1;
+}
+
+/* Removes a stale socket, but nothing that isn't one. */
+int remove_socket(const char *path)
+{
+	struct stat st;
+
+	if (lstat(path, &st) < 0) {
+		if (errno == ENOENT) return 0;
+		perror(path);
+		return -1;
+	}
+	if (!S_ISSOCK(st.st_mode)) {
+		fprintf(stderr, "%s: exists and is not a socket\n", path);
+		return -1;
+	}
+	if (unlink(path) < 0) {
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
+
+int run_serve(void)
+{
+	struct sockaddr_un sun;
+	struct sigaction sa;
+	pthread_attr_t attr;
+	pthread_t thread;
+	int fd, conn;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	if (strlen(serve_path) >= sizeof(sun.sun_path)) {
+		fprintf(stderr, "Socket path too long: %s\n", serve_path);
+		return EXIT_FAILURE;
+	}
+	strcpy(sun.sun_path, serve_path);
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0)) < 0) {
+		perror("socket");
+		return EXIT_FAILURE;
+	}
+	if (remove_socket(serve_path) < 0) {
+		close(fd);
+		return EXIT_FAILURE;
+	}
+	if (bind(fd, (struct sockaddr*)&sun, sizeof(sun)) < 0 || listen(fd, 128) < 0) {
+		perror(serve_path);
+		return EXIT_FAILURE;
+	}
+
+	/* no SA_RESTART, so accept() returns when we're asked to stop */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = stop_serving;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	fprintf(stderr, "serving on %s\n", serve_path);
+	while (!stopping) {
+		if ((conn = accept(fd, NULL, NULL)) < 0) {
+			if (errno != EINTR) perror("accept");
+			continue;
+		}
+		if (pthread_create(&thread, &attr, serve_thread, (void*)(size_t)conn) != 0) {
+			perror("pthread_create");
+			close(conn);
+		}
+	}
+	close(fd);
+	remove_socket(serve_path);
+
+	pthread_mutex_lock(&flight_lock);
+	fprintf(stderr, "%lu requests, %lu upstream lookups\n", served, upstream);
+	pthread_mutex_unlock(&flight_lock);
+	return EXIT_SUCCESS;
+}
+
+/*
+ * The client side: one connection, with a FILE for each direction.
+ */
+struct client {
+	FILE *in;
+	FILE *out;
+};
+
+int client_connect(struct client *c)
+{
+	struct sockaddr_un sun;
+	int fd;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strncpy(sun.sun_path, client_path, sizeof(sun.sun_path) - 1);
+	if ((fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0)) < 0) {
+		perror("socket");
+		return -1;
+	}
+	if (connect(fd, (struct sockaddr*)&sun, sizeof(sun)) < 0) {
+		perror(client_path);
+		close(fd);
+		return -1;
+	}
+	c->in = fdopen(fd, "r");
+	c->out = fdopen(dup(fd), "w");
+	if (!c->in || !c->out) {
+		perror("fdopen");
+		return -1;
+	}
+	return 0;
+}
+
+void client_close(struct client *c)
+{
+	fclose(c->out);
+	fclose(c->in);
+}
+
+/* Sends one line and reads the answer into buf; returns 0 on success. */
+int client_ask(struct client *c, const char *line, char *buf, size_t len)
+{
+	if (fprintf(c->out, "%s\n", line) < 0 || fflush(c->out) != 0 || !fgets(buf, len, c->in)) {
+		return -1;
+	}
+	strip_line(buf);
+	return 0;
+}
+
+/* Maps an error message from the server back to its EAI_* code. */
+int gai_code(const char *message)
+{
+	static const int codes[] = {
+		EAI_AGAIN, EAI_BADFLAGS, EAI_FAIL, EAI_FAMILY, EAI_MEMORY,
+		EAI_NONAME, EAI_SERVICE, EAI_SOCKTYPE, EAI_SYSTEM, EAI_OVERFLOW
+	};
+	unsigned int i;
+	for (i = 0; i < sizeof(codes) / sizeof(codes[0]); i++) {
+		if (strcmp(gai_strerror(codes[i]), message) == 0) return codes[i];
+	}
+	return EAI_FAIL;
+}
+
+/* resolve() by way of the server, parsing its --batch format answer. */
+int client_resolve(struct client *c, const char *name, struct resolution *r)
+{
+	char buf[MAX_ADDRS * (INET6_ADDRSTRLEN + HOSTNAME_LEN + 2) + 2 * HOSTNAME_LEN];
+	char *field, *next, *ptr;
+	int af;
+
+	r->h_error = r->gai_error = r->ni_error = r->ha_error = 0;
+	r->gai_ns[0] = r->gai_ns[1] = 0;
+	r->gai_errors[0] = r->gai_errors[1] = 0;
+	r->h_name[0] = r->canon[0] = 0;
+	r->naddrs = 0;
+
+	if (client_ask(c, name, buf, sizeof(buf)) != 0) {
+		r->gai_error = EAI_SYSTEM;
+		return -1;
+	}
+	if (!(field = strchr(buf, '\t'))) {
+		r->gai_error = EAI_FAIL;
+		return 0;
+	}
+	field ++;
+	if (*field == '!') {
+		r->gai_error = gai_code(field + 1);
+		return 0;
+	}
+	if ((next = strchr(field, '\t'))) {
+		*next++ = 0;
+	}
+	copy_name(r->canon, field);
+	for (field = next; field && *field && r->naddrs < MAX_ADDRS; field = next) {
+		if ((next = strchr(field, ' '))) {
+			*next++ = 0;
+		}
+		if ((ptr = strchr(field, '='))) {
+			*ptr++ = 0;
+		}
+		af = strchr(field, ':') ? AF_INET6 : AF_INET;
+		if (inet_pton(af, field, r->addrs[r->naddrs].addr) == 1) {
+			r->addrs[r->naddrs].family = af;
+			copy_name(r->addrs[r->naddrs].ptr, ptr ? ptr : "");
+			r->naddrs ++;
+		}
+	}
+	return 0;
+}
+
+/* Reads the server's request and upstream lookup counters. */
+int client_stats(unsigned long *requests, unsigned long *lookups)
+{
+	struct client c;
+	char buf[128];
+	int ok;
+
+	if (client_connect(&c) != 0) return -1;
+	ok = client_ask(&c, "!stats", buf, sizeof(buf)) == 0 &&
+		sscanf(buf, "!stats\t%lu\t%lu", requests, lookups) == 2;
+	client_close(&c);
+	return ok ? 0 : -1;
+}
+
+int run_client(void)
+{
+	struct client c;
+	char buf[MAX_ADDRS * (INET6_ADDRSTRLEN + HOSTNAME_LEN + 2) + 2 * HOSTNAME_LEN];
+	int i, status = EXIT_SUCCESS;
+
+	if (client_connect(&c) != 0) {
+		return EXIT_FAILURE;
+	}
+	for (i = 0; i < nnames; i++) {
+		if (client_ask(&c, names[i], buf, sizeof(buf)) != 0) {
+			fprintf(stderr, "%s: connection lost\n", client_path);
+			status = EXIT_FAILURE;
+			break;
+		}
+		printf("%s\n", buf);
+	}
+	client_close(&c);
+	return status;
+}
+
+/*
+ * BENCHMARK
+ */
+
+#define MAX_ERRORS 16
+
+struct error_count {
+	const char *stage;
+	int legacy;	/* h_errno rather than EAI_* */
+	int code;
+	unsigned long count;
+};
+
+struct bench_stats {
+	unsigned long queries;
+	unsigned long failed;
+	struct histogram latency;
+	struct histogram family_latency[2];	/* with --split */
+	int nerrors;
+	struct error_count errors[MAX_ERRORS];
+};
+
+struct bench_worker {
+	pthread_t thread;
+	struct bench_stats stats;
+};
+
+unsigned long bench_next = 0;
+unsigned long long bench_start = 0;
+unsigned long long bench_end = 0;
+
+void count_error(struct bench_stats *s, const char *stage, int legacy, int code, unsigned long n)
+{
+	struct error_count *e;
+	int i;
+	for (i = 0; i < s->nerrors; i++) {
+		e = &s->errors[i];
+		if (e->stage == stage && e->code == code) {
+			e->count += n;
+			return;
+		}
+	}
+	if (s->nerrors == MAX_ERRORS) {
+		/* lump the rest in with the last one */
+		s->errors[MAX_ERRORS - 1].count += n;
+		return;
+	}
+	e = &s->errors[s->nerrors++];
+	e->stage = stage;
+	e->legacy = legacy;
+	e->code = code;
+	e->count = n;
+}
+
+void *bench_thread(void *arg)
+{
+	struct bench_worker *w = (struct bench_worker*)arg;
+	struct resolution *r;
+	struct client c;
+	unsigned long seq;
+	unsigned long long due, t;
+
+	r = malloc(sizeof(*r));
+	if (!r) {
+		perror("malloc");
+		return NULL;
+	}
+	if (client_path && client_connect(&c) != 0) {
+		free(r);
+		return NULL;
+	}
+	for (;;) {
+		seq = __sync_fetch_and_add(&bench_next, 1);
+		if (query_rate > 0) {
+			/* open loop: query 'seq' is due at a fixed time, whether or not
+			 * earlier queries have completed */
+			due = bench_start + (unsigned long long)seq * 1000000000ULL / query_rate;
+			if (due >= bench_end) break;
+			sleep_until(due);
+		} else {
+			due = now_ns();
+			if (due >= bench_end) break;
+		}
+
+		if (client_path) {
+			client_resolve(&c, names[seq % nnames], r);
+		} else {
+			resolve(names[seq % nnames], lookup_flags, r);
+		}
+
+		/* latency is measured from when the query was due, so a backlog
+		 * shows up as latency rather than being hidden */
+		t = now_ns();
+		hist_add(&w->stats.latency, (t - due) / 1000);
+		w->stats.queries ++;
+		if (split_families && r->gai_ns[0]) {
+			hist_add(&w->stats.family_latency[0], r->gai_ns[0] / 1000);
+			hist_add(&w->stats.family_latency[1], r->gai_ns[1] / 1000);
+		}
+
+		if (r->h_error || r->gai_error || r->ni_error || r->ha_error) {
+			w->stats.failed ++;
+		}
+		if (r->h_error) count_error(&w->stats, "gethostbyname", 1, r->h_error, 1);
+		if (r->gai_error) count_error(&w->stats, "getaddrinfo", 0, r->gai_error, 1);
+		if (r->ni_error) count_error(&w->stats, "getnameinfo", 0, r->ni_error, 1);
+		if (r->ha_error) count_error(&w->stats, "gethostbyaddr", 1, r->ha_error, 1);
+	}
+	if (client_path) {
+		client_close(&c);
+	}
+	free(r);
+	return NULL;
+}
+
+void merge_stats(struct bench_stats *into, const struct bench_stats *from)
+{
+	const struct error_count *e;
+	int i;
+	into->queries += from->queries;
+	into->failed += from->failed;
+	hist_merge(&into->latency, &from->latency);
+	hist_merge(&into->family_latency[0], &from->family_latency[0]);
+	hist_merge(&into->family_latency[1], &from->family_latency[1]);
+	for (i = 0; i < from->nerrors; i++) {
+		e = &from->errors[i];
+		count_error(into, e->stage, e->legacy, e->code, e->count);
+	}
+}
+
+int bench_phase(const char *label, double *qps)
+{
+	struct bench_worker *workers;
+	struct bench_stats *total;
+	const struct error_count *e;
+	double elapsed;
+	int n, i;
+
+	n = concurrency;
+	if (n == 0) {
+		n = query_rate > 0 ? 64 : 8;
+	}
+	workers = calloc(n, sizeof(*workers));
+	total = calloc(1, sizeof(*total));
+	if (!workers || !total) {
+		perror("calloc");
+		return EXIT_FAILURE;
+	}
+
+	printf("***\n*** bench (%s): %d names, %d workers, ", label, nnames, n);
+	if (query_rate > 0) {
+		printf("%d queries/s, ", query_rate);
+	}
+	printf("%d seconds\n***\n\n", bench_duration);
+	fflush(stdout);
+
+	bench_next = 0;
+	bench_start = now_ns();
+	bench_end = bench_start + (unsigned long long)bench_duration * 1000000000ULL;
+	for (i = 0; i < n; i++) {
+		if (pthread_create(&workers[i].thread, NULL, bench_thread, &workers[i]) != 0) {
+			perror("pthread_create");
+			return EXIT_FAILURE;
+		}
+	}
+	for (i = 0; i < n; i++) {
+		pthread_join(workers[i].thread, NULL);
+		merge_stats(total, &workers[i].stats);
+	}
+	elapsed = (now_ns() - bench_start) / 1e9;
+	*qps = total->queries / elapsed;
+
+	printf("queries = %lu\n", total->queries);
+	printf("failed = %lu (%.2f%%)\n", total->failed, total->queries ? 100.0 * total->failed / total->queries : 0.0);
+	printf("elapsed = %.3f s\n", elapsed);
+	printf("qps = %.1f", total->queries / elapsed);
+	if (query_rate > 0 && total->queries / elapsed < query_rate * 0.95) {
+		printf(" (below target; try more --concurrency)");
+	}
+	printf("\nlatency_us = {\n");
+	hist_print(&total->latency, "  ");
+	printf("}\n");
+	if (split_families) {
+		printf("getaddrinfo_us[AF_INET] = {\n");
+		hist_print(&total->family_latency[0], "  ");
+		printf("}\ngetaddrinfo_us[AF_INET6] = {\n");
+		hist_print(&total->family_latency[1], "  ");
+		printf("}\n");
+	}
+	if (total->nerrors) {
+		printf("errors = {\n");
+		for (i = 0; i < total->nerrors; i++) {
+			e = &total->errors[i];
+			printf("  %s: %s = %lu\n", e->stage, e->legacy ? myerr(e->code) : gai_strerror(e->code), e->count);
+		}
+		printf("}\n");
+	}
+	printf("\n");
+
+	i = total->failed == total->queries ? EXIT_FAILURE : EXIT_SUCCESS;
+	free(total);
+	free(workers);
+	return i;
+}
+
+/*
+ * With --client, the lookups go through a --serve process, and its
+ * counters show how many upstream lookups single-flight saved.
+ */
+int bench_client(void)
+{
+	unsigned long requests[2], lookups[2];
+	double qps;
+	int status;
+
+	if (client_stats(&requests[0], &lookups[0]) != 0) {
+		return EXIT_FAILURE;
+	}
+	status = bench_phase(client_path, &qps);
+	if (client_stats(&requests[1], &lookups[1]) != 0) {
+		return EXIT_FAILURE;
+	}
+	requests[1] -= requests[0];
+	lookups[1] -= lookups[0];
+	printf("server: %lu requests, %lu upstream lookups (%.1f%% saved)\n", requests[1], lookups[1],
+		requests[1] ? 100.0 * (requests[1] - lookups[1]) / requests[1] : 0.0);
+	return status;
+}
+
+/* With --hosts, runs the names through NSS and then through the index. */
+int run_bench(void)
+{
+	struct hosts_index *index = hosts;
+	double nss_qps, index_qps;
+	int status;
+
+	if (nnames == 0) {
+		fprintf(stderr, "--bench: no names given\n");
+		return EXIT_FAILURE;
+	}
+	if (client_path) {
+		return bench_client();
+	}
+	hosts = NULL;
+	status = bench_phase("NSS", &nss_qps);
+	if (!index) {
+		return status;
+	}
+	hosts = index;
+	if (bench_phase(index->path, &index_qps) != EXIT_SUCCESS) {
+		status = EXIT_FAILURE;
+	}
+	printf("%s index vs NSS: %.1fx the throughput\n", index->path, nss_qps > 0 ? index_qps / nss_qps : 0.0);
+	return status;
+}
+
+/*
+ * PTR SWEEP
+ */
+
+struct cidr {
+	int family;
+	unsigned char base[16];	/* host bits cleared */
+	int prefix;
+};
+
+/* Parses "ADDRESS/PREFIX"; a bare address is a single host. */
+int parse_cidr(const char *s, struct cidr *c)
+{
+	char buf[INET6_ADDRSTRLEN + 8];
+	char *slash, *end;
+	int bits, i;
+
+	if (strlen(s) >= sizeof(buf)) return -1;
+	strcpy(buf, s);
+	slash = strchr(buf, '/');
+	if (slash) *slash = 0;
+
+	if (inet_pton(AF_INET, buf, c->base) == 1) {
+		c->family = AF_INET;
+	} else if (inet_pton(AF_INET6, buf, c->base) == 1) {
+		c->family = AF_INET6;
+	} else {
+		return -1;
+	}
+	bits = addr_len(c->family) * 8;
+	c->prefix = bits;
+	if (slash) {
+		c->prefix = (int)strtol(slash + 1, &end, 10);
+		if (end == slash + 1 || *end || c->prefix < 0 || c->prefix > bits) return -1;
+	}
+	for (i = c->prefix; i < bits; i++) {
+		c->base[i / 8] &= ~(0x80 >> (i % 8));
+	}
+	return 0;
+}
+
+/*
+ * Hands out the addresses in a prefix one at a time, so even a /64 costs
+ * no more memory than a /32.
+ */
+struct sweep_cursor {
+	pthread_mutex_t lock;
+	struct cidr range;
+	unsigned char next[16];
+	unsigned long long seq;
+	int done;
+};
+
+void cursor_init(struct sweep_cursor *cur, const struct cidr *range)
+{
+	pthread_mutex_init(&cur->lock, NULL);
+	cur->range = *range;
+	memcpy(cur->next, range->base, sizeof(cur->next));
+	cur->seq = 0;
+	cur->done = 0;
+}
+
+/* Returns 0 when the range is exhausted. */
+int cursor_next(struct sweep_cursor *cur, unsigned char *addr, unsigned long long *seq)
+{
+	int n, i, bits;
+
+	pthread_mutex_lock(&cur->lock);
+	if (cur->done) {
+		pthread_mutex_unlock(&cur->lock);
+		return 0;
+	}
+	n = addr_len(cur->range.family);
+	memcpy(addr, cur->next, n);
+	*seq = cur->seq++;
+
+	/* big-endian increment; finished when the carry reaches the prefix */
+	bits = n * 8 - cur->range.prefix;
+	for (i = n - 1; i >= 0; i--) {
+		if (++cur->next[i] != 0) break;
+	}
+	if (bits == 0 || i < 0) {
+		cur->done = 1;
+	} else if (bits < n * 8) {
+		i = cur->range.prefix;
+		if ((cur->next[i / 8] ^ cur->range.base[i / 8]) & (0xff00 >> (i % 8)) & 0xff) {
+			cur->done = 1;
+		} else if (memcmp(cur->next, cur->range.base, i / 8) != 0) {
+			cur->done = 1;
+		}
+	}
+	pthread_mutex_unlock(&cur->lock);
+	return 1;
+}
+
+struct sweep_state {
+	struct sweep_cursor cursor;
+	pthread_mutex_t out_lock;
+	unsigned long long start;
+	unsigned long found;
+	unsigned long failed;
+	unsigned long last_error;
+};
+
+void *sweep_thread(void *arg)
+{
+	struct sweep_state *st = (struct sweep_state*)arg;
+	unsigned char addr[16];
+	unsigned long long seq;
+	char ptr[HOSTNAME_LEN];
+	char text[INET6_ADDRSTRLEN];
+	int af = st->cursor.range.family;
+	int error;
+
+	while (cursor_next(&st->cursor, addr, &seq)) {
+		if (query_rate > 0) {
+			sleep_until(st->start + seq * 1000000000ULL / query_rate);
+		}
+		error = lookup_ptr(af, addr, ptr);
+		if (error != 0) {
+			__sync_fetch_and_add(&st->failed, 1);
+			__sync_lock_test_and_set(&st->last_error, error);
+			continue;
+		}
+		if (!*ptr) continue;
+
+		format_addr(af, addr, text, sizeof(text));
+		pthread_mutex_lock(&st->out_lock);
+		printf("%s\t%s\n", text, ptr);
+		fflush(stdout);
+		st->found ++;
+		pthread_mutex_unlock(&st->out_lock);
+	}
+	return NULL;
+}
+
+int run_sweep(const char *spec)
+{
+	struct sweep_state st;
+	struct cidr range;
+	pthread_t *threads;
+	int n, i;
+
+	if (parse_cidr(spec, &range) != 0) {
+		fprintf(stderr, "Invalid CIDR range: %s\n", spec);
+		return EXIT_FAILURE;
+	}
+	n = concurrency ? concurrency : 32;
+	threads = calloc(n, sizeof(*threads));
+	if (!threads) {
+		perror("calloc");
+		return EXIT_FAILURE;
+	}
+
+	memset(&st, 0, sizeof(st));
+	cursor_init(&st.cursor, &range);
+	pthread_mutex_init(&st.out_lock, NULL);
+	st.start = now_ns();
+	for (i = 0; i < n; i++) {
+		if (pthread_create(&threads[i], NULL, sweep_thread, &st) != 0) {
+			perror("pthread_create");
+			return EXIT_FAILURE;
+		}
+	}
+	for (i = 0; i < n; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	fprintf(stderr, "sweep %s: %llu addresses, %lu with PTR, %lu failed, %.3f s\n",
+		spec, st.cursor.seq, st.found, st.failed, (now_ns() - st.start) / 1e9);
+	if (st.failed) {
+		fprintf(stderr, "  last error: %s\n", gai_strerror((int)st.last_error));
+	}
+	free(threads);
+	return EXIT_SUCCESS;
+}
+
+/*
+ * WATCH
+ */
+
+/* Accepts #, #s, #m or #h; returns seconds, or 0 if invalid. */
+int parse_interval(const char *s)
+{
+	char *end;
+	long n = strtol(s, &end, 10);
+	if (end == s || n < 1) return 0;
+	switch (*end) {
+	case 0: case 's': break;
+	case 'm': n *= 60; break;
+	case 'h': n *= 3600; break;
+	default: return 0;
+	}
+	if (*end && end[1]) return 0;
+	return n > 0x7fffffff ? 0 : (int)n;
+}
+
+void watch_stamp(const char *name)
+{
+	char buf[32];
+	time_t t = time(NULL);
+	strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", localtime(&t));
+	printf("%s %s ", buf, name);
+}
+
+int find_addr(const struct resolution *r, const struct resolved_addr *ra)
+{
+	int i;
+	for (i = 0; i < r->naddrs; i++) {
+		if (r->addrs[i].family == ra->family && memcmp(r->addrs[i].addr, ra->addr, addr_len(ra->family)) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Prints what changed between two results for a name; returns the number
+ * of changes.  A failed lookup is reported as such, and leaves the last
+ * good result standing rather than showing every address as removed.
+ */
+int watch_diff(const char *name, const struct resolution *was, const struct resolution *now)
+{
+	const struct resolved_addr *ra;
+	char text[INET6_ADDRSTRLEN];
+	int changes = 0;
+	int i, j;
+
+	if (now->gai_error != was->gai_error) {
+		watch_stamp(name);
+		if (now->gai_error) {
+			printf("error getaddrinfo: %s\n", gai_strerror(now->gai_error));
+		} else {
+			printf("ok\n");
+		}
+		changes ++;
+	}
+	if (now->gai_error) {
+		return changes;
+	}
+
+	if (strcmp(was->canon, now->canon) != 0) {
+		watch_stamp(name);
+		printf("canonname \"%s\" -> \"%s\"\n", was->canon, now->canon);
+		changes ++;
+	}
+	for (i = 0; i < was->naddrs; i++) {
+		ra = &was->addrs[i];
+		if (find_addr(now, ra) < 0) {
+			format_addr(ra->family, ra->addr, text, sizeof(text));
+			watch_stamp(name);
+			printf("-address %s\n", text);
+			changes ++;
+		}
+	}
+	for (i = 0; i < now->naddrs; i++) {
+		ra = &now->addrs[i];
+		format_addr(ra->family, ra->addr, text, sizeof(text));
+		if ((j = find_addr(was, ra)) < 0) {
+			watch_stamp(name);
+			printf("+address %s", text);
+			if (*ra->ptr) {
+				printf(" ptr \"%s\"", ra->ptr);
+			}
+			printf("\n");
+			changes ++;
+		} else if (!ra->ptr_error && strcmp(was->addrs[j].ptr, ra->ptr) != 0) {
+			watch_stamp(name);
+			printf("ptr %s \"%s\" -> \"%s\"\n", text, was->addrs[j].ptr, ra->ptr);
+			changes ++;
+		}
+	}
+	return changes;
+}
+
+/* As with a failed lookup, a failed reverse lookup keeps the last PTR. */
+void keep_ptrs(const struct resolution *was, struct resolution *now)
+{
+	int i, j;
+	for (i = 0; i < now->naddrs; i++) {
+		if (now->addrs[i].ptr_error && (j = find_addr(was, &now->addrs[i])) >= 0) {
+			copy_name(now->addrs[i].ptr, was->addrs[j].ptr);
+		}
+	}
+}
+
+int run_watch(void)
+{
+	struct resolution *prev, *next, *tmp;
+	struct hosts_index *fresh;
+	unsigned long long start;
+	int cycle, i;
+
+	if (nnames == 0) {
+		fprintf(stderr, "--watch: no names given\n");
+		return EXIT_FAILURE;
+	}
+	prev = calloc(nnames, sizeof(*prev));
+	next = calloc(nnames, sizeof(*next));
+	if (!prev || !next) {
+		perror("calloc");
+		return EXIT_FAILURE;
+	}
+
+	/* the first pass is diffed against nothing, so it prints everything */
+	start = now_ns();
+	for (cycle = 0; watch_count == 0 || cycle < watch_count; cycle++) {
+		if (cycle > 0) {
+			sleep_until(start + (unsigned long long)cycle * watch_interval * 1000000000ULL);
+		}
+		if ((fresh = hosts_reload())) {
+			/* between passes, so no lookup is using the old index */
+			hosts_close(hosts);
+			hosts = fresh;
+		}
+		resolve_batch(names, nnames, next);
+		for (i = 0; i < nnames; i++) {
+			watch_diff(names[i], &prev[i], &next[i]);
+			if (next[i].gai_error) {
+				/* keep the last good addresses to diff against */
+				prev[i].gai_error = next[i].gai_error;
+				next[i] = prev[i];
+			} else {
+				keep_ptrs(&prev[i], &next[i]);
+			}
+		}
+		fflush(stdout);
+		tmp = prev;
+		prev = next;
+		next = tmp;
+	}
+
+	free(prev);
+	free(next);
+	return EXIT_SUCCESS;
+}
+
+/*
+ * CONNECT PROBE
+ */
+
+struct probe {
+	int fd;
+	int family;
+	unsigned char addr[16];
+	unsigned long long latency;	/* ns */
+	int error;			/* 0 = connected; ETIMEDOUT if never answered */
+	int done;
+};
+
+int probe_cmp(const void *a, const void *b)
+{
+	const struct probe *pa = (const struct probe*)a;
+	const struct probe *pb = (const struct probe*)b;
+	if (!pa->error != !pb->error) return pa->error ? 1 : -1;
+	if (pa->latency != pb->latency) return pa->latency < pb->latency ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Starts a non-blocking connect to every SOCK_STREAM result at once and
+ * times each one, so the fastest address wins regardless of family or
+ * the order getaddrinfo() returned them in.
+ */
+int run_probe(const char *name)
+{
+	struct addrinfo  hints;
+	struct addrinfo *result;
+	struct addrinfo *res;
+	struct resolution seen;
+	struct probe *probes;
+	struct probe *p;
+	struct epoll_event ev, events[64];
+	struct sockaddr_storage ss;
+	char text[INET6_ADDRSTRLEN];
+	unsigned long long start, deadline, t;
+	socklen_t len;
+	int from_hosts;
+	int ep, n, i, k, pending, error;
+
+	printf("***\n*** %s port %d\n***\n\n", name, probe_port);
+
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_V4MAPPED;
+	from_hosts = hosts_getaddrinfo(name, &hints, &result) == 0;
+	error = from_hosts ? 0 : getaddrinfo(name, NULL, &hints, &result);
+	if (error != 0) {
+		fprintf(stderr, "error in getaddrinfo: %s\n", gai_strerror(error));
+		return EXIT_FAILURE;
+	}
+
+	/* the same address can come back more than once */
+	seen.naddrs = 0;
+	for (res = result; res != NULL; res = res->ai_next) {
+		add_address(&seen, res->ai_addr);
+	}
+	if (from_hosts) {
+		hosts_freeaddrinfo(result);
+	} else {
+		freeaddrinfo(result);
+	}
+
+	if (!(probes = calloc(seen.naddrs, sizeof(*probes)))) {
+		perror("calloc");
+		return EXIT_FAILURE;
+	}
+	if ((ep = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+		perror("epoll_create1");
+		return EXIT_FAILURE;
+	}
+
+	start = now_ns();
+	deadline = start + (unsigned long long)probe_timeout * 1000000ULL;
+	pending = 0;
+	for (i = 0; i < seen.naddrs; i++) {
+		p = &probes[i];
+		p->family = seen.addrs[i].family;
+		memcpy(p->addr, seen.addrs[i].addr, sizeof(p->addr));
+		p->fd = socket(p->family, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, IPPROTO_TCP);
+		if (p->fd < 0) {
+			p->error = errno;
+			p->done = 1;
+			continue;
+		}
+		len = make_sockaddr(p->family, p->addr, probe_port, &ss);
+		if (connect(p->fd, (struct sockaddr*)&ss, len) == 0) {
+			p->latency = now_ns() - start;
+			p->done = 1;
+		} else if (errno != EINPROGRESS) {
+			p->error = errno;
+			p->latency = now_ns() - start;
+			p->done = 1;
+		} else {
+			ev.events = EPOLLOUT;
+			ev.data.u32 = i;
+			epoll_ctl(ep, EPOLL_CTL_ADD, p->fd, &ev);
+			pending ++;
+		}
+	}
+
+	while (pending > 0 && (t = now_ns()) < deadline) {
+		n = epoll_wait(ep, events, 64, (int)((deadline - t + 999999) / 1000000));
+		if (n < 0 && errno != EINTR) {
+			perror("epoll_wait");
+			break;
+		}
+		for (k = 0; k < n; k++) {
+			p = &probes[events[k].data.u32];
+			if (p->done) continue;
+			t = now_ns();
+			len = sizeof(error);
+			if (getsockopt(p->fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0) {
+				error = errno;
+			}
+			p->error = error;
+			p->latency = t - start;
+			p->done = 1;
+			epoll_ctl(ep, EPOLL_CTL_DEL, p->fd, NULL);
+			pending --;
+		}
+	}
+
+	for (i = 0; i < seen.naddrs; i++) {
+		p = &probes[i];
+		if (!p->done) {
+			p->error = ETIMEDOUT;
+			p->latency = now_ns() - start;
+		}
+		if (p->fd >= 0) {
+			close(p->fd);
+		}
+	}
+	close(ep);
+
+	qsort(probes, seen.naddrs, sizeof(*probes), probe_cmp);
+	for (i = 0; i < seen.naddrs; i++) {
+		p = &probes[i];
+		format_addr(p->family, p->addr, text, sizeof(text));
+		if (p->error) {
+			printf("  -. %s [AF_%s] %s\n", text, family(p->family), strerror(p->error));
+		} else {
+			printf("  %d. %s [AF_%s] %.3f ms\n", i + 1, text, family(p->family), p->latency / 1e6);
+		}
+	}
+	printf("\n");
+
+	error = seen.naddrs && !probes[0].error ? EXIT_SUCCESS : EXIT_FAILURE;
+	free(probes);
+	return error;
+}
+
+/*
+ * LOG ENRICHMENT
+ *
+ * The log is taken a window at a time: the addresses in the window are
+ * found, the ones not already cached are reverse-resolved together with
+ * resolve_batch(), and then the window is written out with each
+ * address's PTR inserted after it as ADDRESS[NAME].  Memory use is bounded
+ * by the window and the cache, whatever the size of the log.
+ */
+
+#define ENRICH_WINDOW (1 << 20)	/* bytes of log per pass */
+#define ENRICH_SLOTS  (1 << 19)	/* cache table size */
+#define ENRICH_KEEP   (1 << 17)	/* cached addresses kept between passes */
+
+struct ptr_slot {
+	int family;		/* 0 if empty */
+	unsigned char addr[16];
+	char *name;		/* NULL until resolved; "" if no PTR */
+};
+
+struct match {
+	size_t end;		/* offset just past the address */
+	struct ptr_slot *slot;
+};
+
+struct enricher {
+	struct ptr_slot *cache;
+	unsigned int cached;
+	struct match *matches;
+	size_t nmatches;
+	size_t maxmatches;
+	struct ptr_slot **pending;
+	size_t maxpending;
+	unsigned long addresses;
+	unsigned long lookups;
+};
+
+struct ptr_slot *cache_find(struct enricher *en, int af, const unsigned char *addr)
+{
+	struct ptr_slot *slot;
+	unsigned int j;
+
+	for (j = hash_addr(af, addr); (slot = &en->cache[j & (ENRICH_SLOTS - 1)])->family; j++) {
+		if (slot->family == af && memcmp(slot->addr, addr, addr_len(af)) == 0) {
+			return slot;
+		}
+	}
+	slot->family = af;
+	memcpy(slot->addr, addr, addr_len(af));
+	slot->name = NULL;
+	en->cached ++;
+	return slot;
+}
+
+void cache_clear(struct enricher *en)
+{
+	unsigned int i;
+	for (i = 0; i < ENRICH_SLOTS; i++) {
+		if (en->cache[i].name && *en->cache[i].name) {
+			free(en->cache[i].name);
+		}
+		en->cache[i].family = 0;
+	}
+	en->cached = 0;
+}
+
+int addr_char(char c)
+{
+	return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F') || c == ':' || c == '.';
+}
+
+int word_char(char c)
+{
+	return addr_char(c) || (c >= 'g' && c <= 'z') || (c >= 'G' && c <= 'Z') || c == '_';
+}
+
+/*
+ * Finds the IPv4 and IPv6 literals in buf.  Candidates are whole runs of
+ * hex digits, colons and dots; only runs that look like an address are
+ * passed to inet_pton().  A run with a single colon is an IPv4 address
+ * and a port, as in src=10.0.0.1:443; a run may also follow a colon, as
+ * in client:10.0.0.1.  A bracketed address keeps its brackets, as in
+ * [::1]:443, so the name goes after the closing one.  Stops early if the
+ * cache fills up, and returns how much of buf it scanned.
+ */
+size_t scan_window(struct enricher *en, const char *buf, size_t len)
+{
+	unsigned char addr[16];
+	char text[INET6_ADDRSTRLEN + 1];
+	struct match *tmp;
+	size_t i = 0, start, n, k;
+	int colons, dots, af;
+
+	en->nmatches = 0;
+	while (i < len) {
+		if (!addr_char(buf[i]) || (i > 0 && buf[i - 1] != ':' && word_char(buf[i - 1]))) {
+			i ++;
+			continue;
+		}
+		start = i;
+		colons = dots = 0;
+		for (; i < len && addr_char(buf[i]); i++) {
+			if (buf[i] == ':') colons ++;
+			else if (buf[i] == '.') dots ++;
+		}
+		if (i < len && word_char(buf[i])) continue;	/* part of a longer word */
+		n = i - start;
+		while (n && buf[start + n - 1] == '.') {	/* end of a sentence */
+			n --;
+			dots --;
+		}
+		if (colons == 1) {
+			/* ADDR:PORT; the name goes after the address */
+			for (k = start + n; k > start && buf[k - 1] >= '0' && buf[k - 1] <= '9'; k--) ;
+			if (k == start + n || k == start || buf[k - 1] != ':') continue;
+			n = k - 1 - start;
+			colons = 0;
+		}
+		if (colons >= 2) {
+			af = AF_INET6;
+		} else if (colons == 0 && dots == 3) {
+			af = AF_INET;
+		} else {
+			continue;
+		}
+		if (n < 2 || n > INET6_ADDRSTRLEN) continue;
+		memcpy(text, buf + start, n);
+		text[n] = 0;
+		if (inet_pton(af, text, addr) != 1) continue;
+
+		if (en->nmatches == en->maxmatches) {
+			en->maxmatches = en->maxmatches ? en->maxmatches * 2 : 1024;
+			if (!(tmp = realloc(en->matches, en->maxmatches * sizeof(*tmp)))) {
+				perror("realloc");
+				exit(EXIT_FAILURE);
+			}
+			en->matches = tmp;
+		}
+		en->matches[en->nmatches].end = start + n;
+		if (start > 0 && buf[start - 1] == '[' && start + n < len && buf[start + n] == ']') {
+			en->matches[en->nmatches].end ++;
+		}
+		en->matches[en->nmatches].slot = cache_find(en, af, addr);
+		en->nmatches ++;
+		en->addresses ++;
+		if (en->cached >= ENRICH_SLOTS / 2) {
+			return start + n;
+		}
+	}
+	return len;
+}
+
+/* Resolves every slot the window found that isn't cached yet. */
+void resolve_window(struct enricher *en)
+{
+	static char text[BATCH_CHUNK][INET6_ADDRSTRLEN];
+	static const char *list[BATCH_CHUNK];
+	static struct resolution results[BATCH_CHUNK];
+	struct ptr_slot *slot, **tmp;
+	size_t i, npending = 0;
+	int n, k;
+
+	for (i = 0; i < en->nmatches; i++) {
+		slot = en->matches[i].slot;
+		if (!slot->name) {
+			slot->name = "";	/* claimed; stays "" if there is no PTR */
+			if (npending == en->maxpending) {
+				en->maxpending = en->maxpending ? en->maxpending * 2 : 1024;
+				if (!(tmp = realloc(en->pending, en->maxpending * sizeof(*tmp)))) {
+					perror("realloc");
+					exit(EXIT_FAILURE);
+				}
+				en->pending = tmp;
+			}
+			en->pending[npending++] = slot;
+		}
+	}
+	en->lookups += npending;
+
+	for (i = 0; i < npending; i += n) {
+		n = npending - i < BATCH_CHUNK ? npending - i : BATCH_CHUNK;
+		for (k = 0; k < n; k++) {
+			slot = en->pending[i + k];
+			format_addr(slot->family, slot->addr, text[k], sizeof(text[k]));
+			list[k] = text[k];
+		}
+		resolve_batch(list, n, results);
+		for (k = 0; k < n; k++) {
+			if (results[k].naddrs && *results[k].addrs[0].ptr) {
+				en->pending[i + k]->name = strdup(results[k].addrs[0].ptr);
+			}
+		}
+	}
+}
+
+void enrich_window(struct enricher *en, const char *buf, size_t len)
+{
+	const struct match *m;
+	size_t pos, scanned, i;
+
+	while (len > 0) {
+		if (en->cached > ENRICH_KEEP) {
+			cache_clear(en);
+		}
+		scanned = scan_window(en, buf, len);
+		resolve_window(en);
+
+		pos = 0;
+		for (i = 0; i < en->nmatches; i++) {
+			m = &en->matches[i];
+			if (!*m->slot->name) continue;
+			fwrite(buf + pos, 1, m->end - pos, stdout);
+			printf("[%s]", m->slot->name);
+			pos = m->end;
+		}
+		fwrite(buf + pos, 1, scanned - pos, stdout);
+		buf += scanned;
+		len -= scanned;
+	}
+}
+
+/* Returns the offset just past the last newline in buf, or 0. */
+size_t last_line(const char *buf, size_t len)
+{
+	while (len > 0 && buf[len - 1] != '\n') len--;
+	return len;
+}
+
+/* read(), retried if interrupted */
+ssize_t read_some(int fd, char *buf, size_t len)
+{
+	ssize_t got;
+	while ((got = read(fd, buf, len)) < 0 && errno == EINTR) ;
+	return got;
+}
+
+int run_enrich(const char *path)
+{
+	struct enricher en;
+	struct stat sb;
+	char *buf, *tmp, *map, *eol;
+	size_t size = 0, cap = 2 * ENRICH_WINDOW, pos, end;
+	ssize_t got;
+	int fd = 0;
+
+	memset(&en, 0, sizeof(en));
+	en.cache = calloc(ENRICH_SLOTS, sizeof(*en.cache));
+	if (!en.cache) {
+		perror("calloc");
+		return EXIT_FAILURE;
+	}
+	/* the forward lookup of a literal is free; only the PTR is wanted */
+	lookup_flags = RESOLVE_MODERN|RESOLVE_REVERSE;
+
+	if (strcmp(path, "-") != 0 && (fd = open(path, O_RDONLY)) < 0) {
+		perror(path);
+		return EXIT_FAILURE;
+	}
+
+	if (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size > 0) {
+		/* a file: map it, and drop each window's pages once written */
+		map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) {
+			perror(path);
+			return EXIT_FAILURE;
+		}
+		madvise(map, sb.st_size, MADV_SEQUENTIAL);
+		for (pos = 0; pos < (size_t)sb.st_size; pos = end) {
+			end = pos + ENRICH_WINDOW < (size_t)sb.st_size ? pos + ENRICH_WINDOW : (size_t)sb.st_size;
+			if (end < (size_t)sb.st_size && (eol = memchr(map + end, '\n', sb.st_size - end))) {
+				end = eol - map + 1;
+			} else if (end < (size_t)sb.st_size) {
+				end = sb.st_size;
+			}
+			enrich_window(&en, map + pos, end - pos);
+			madvise(map + (pos & ~(size_t)4095), end - (pos & ~(size_t)4095), MADV_DONTNEED);
+		}
+		munmap(map, sb.st_size);
+	} else {
+		/* a pipe: read a window at a time, carrying over any partial line */
+		if (!(buf = malloc(cap))) {
+			perror("malloc");
+			return EXIT_FAILURE;
+		}
+		for (;;) {
+			got = 1;
+			while (size < ENRICH_WINDOW && (got = read_some(fd, buf + size, cap - size)) != 0) {
+				if (got < 0) {
+					perror(path);
+					return EXIT_FAILURE;
+				}
+				size += got;
+			}
+			if (size == 0) break;
+			if (got == 0) {
+				enrich_window(&en, buf, size);
+				break;
+			}
+			if (!(end = last_line(buf, size))) {
+				/* one very long line: read the rest of it, making room as needed */
+				if (size == cap) {
+					if (!(tmp = realloc(buf, cap * 2))) {
+						perror("realloc");
+						return EXIT_FAILURE;
+					}
+					buf = tmp;
+					cap *= 2;
+				}
+				if ((got = read_some(fd, buf + size, cap - size)) < 0) {
+					perror(path);
+					return EXIT_FAILURE;
+				}
+				if (got > 0) {
+					size += got;
+					continue;
+				}
+				enrich_window(&en, buf, size);
+				break;
+			}
+			enrich_window(&en, buf, end);
+			memmove(buf, buf + end, size - end);
+			size -= end;
+		}
+		free(buf);
+	}
+	if (fd != 0) {
+		close(fd);
+	}
+	fflush(stdout);
+
+	fprintf(stderr, "%lu addresses, %lu lookups\n", en.addresses, en.lookups);
+	cache_clear(&en);
+	free(en.cache);
+	free(en.pending);
+	free(en.matches);
+	return EXIT_SUCCESS;
+}
+
+/*
+ * BACKEND COMPARISON
+ *
+ * --compare runs each name through every backend at once: the legacy NSS
+ * calls, the modern NSS calls, and a direct query to each nameserver in
+ * /etc/resolv.conf.  The NSS calls see /etc/hosts and the search list;
+ * the direct queries are for the name exactly as given, so those are the
+ * places to look first when they disagree.  Address literals are compared
+ * the other way round: gethostbyaddr(), getnameinfo() and PTR queries.
+ */
+
+#define MAX_BACKENDS 8
+
+enum backend_kind { BACKEND_LEGACY, BACKEND_MODERN, BACKEND_DNS };
+
+/* how a backend's lookup came out */
+enum outcome { FOUND, NOT_FOUND, FAILED };
+
+struct backend {
+	enum backend_kind kind;
+	char label[64];
+	int v6;			/* whether it can return AF_INET6 addresses */
+	struct sockaddr_storage server;
+	socklen_t server_len;
+
+	const char *name;
+	int reverse;		/* name is an address literal */
+	int family;		/* ... of this family */
+	unsigned char addr[16];
+
+	enum outcome outcome;
+	char error[64];
+	char canon[HOSTNAME_LEN];	/* or the PTR, when reverse */
+	struct resolution found;	/* only addrs[] is used */
+	unsigned long long ns;
+	pthread_t thread;
+};
+
+struct backend backends[MAX_BACKENDS];
+int nbackends = 0;
+
+void load_nameservers(void)
+{
+	FILE *fp;
+	char line[256], addr[INET6_ADDRSTRLEN + 1];
+	unsigned char raw[16];
+	struct backend *b;
+	int af;
+
+	if (!(fp = fopen("/etc/resolv.conf", "r"))) {
+		perror("/etc/resolv.conf");
+		return;
+	}
+	while (fgets(line, sizeof(line), fp) && nbackends < MAX_BACKENDS) {
+		if (sscanf(line, " nameserver %46s", addr) != 1) continue;
+		af = strchr(addr, ':') ? AF_INET6 : AF_INET;
+		if (inet_pton(af, addr, raw) != 1) continue;	/* e.g. a scoped fe80:: */
+		b = &backends[nbackends++];
+		b->kind = BACKEND_DNS;
+		b->v6 = 1;
+		snprintf(b->label, sizeof(b->label), "dns %s", addr);
+		b->server_len = make_sockaddr(af, raw, 53, &b->server);
+	}
+	fclose(fp);
+}
+
+/* Builds a recursive query; returns its length, or 0 if the name won't fit. */
+size_t dns_query(unsigned char *buf, unsigned short id, const char *name, int qtype)
+{
+	unsigned char *p = buf + 12, *label;
+	const char *s;
+
+	memset(buf, 0, 12);
+	buf[0] = id >> 8;
+	buf[1] = id & 0xff;
+	buf[2] = 0x01;		/* RD */
+	buf[5] = 1;		/* QDCOUNT */
+	for (s = name; *s; ) {
+		label = p++;
+		while (*s && *s != '.') {
+			if (p - buf >= 12 + 255) return 0;
+			*p++ = *s++;
+		}
+		if (p - label - 1 == 0 || p - label - 1 > 63) return 0;
+		*label = p - label - 1;
+		if (*s == '.') s++;
+	}
+	*p++ = 0;
+	*p++ = qtype >> 8;
+	*p++ = qtype & 0xff;
+	*p++ = 0;
+	*p++ = 1;		/* IN */
+	return p - buf;
+}
+
+/* Reads a possibly-compressed name at *off; returns 0 if malformed. */
+int dns_name(const unsigned char *msg, size_t len, size_t *off, char *out, size_t outlen)
+{
+	size_t pos = *off, n = 0;
+	int jumps = 0, jumped = 0;
+	unsigned int l;
+
+	for (;;) {
+		if (pos >= len) return 0;
+		l = msg[pos];
+		if ((l & 0xc0) == 0xc0) {
+			if (pos + 1 >= len || ++jumps > 16) return 0;
+			if (!jumped) *off = pos + 2;
+			jumped = 1;
+			pos = ((l & 0x3f) << 8) | msg[pos + 1];
+			continue;
+		}
+		pos ++;
+		if (l == 0) break;
+		if (pos + l > len || n + l + 2 > outlen) return 0;
+		if (n) out[n++] = '.';
+		memcpy(out + n, msg + pos, l);
+		n += l;
+		pos += l;
+	}
+	out[n] = 0;
+	if (!jumped) *off = pos;
+	return 1;
+}
+
+/*
+ * Reads the answers to one query into b.  Returns the response code, or
+ * -1 if the message is malformed.
+ */
+int dns_answers(struct backend *b, const unsigned char *msg, size_t len)
+{
+	char owner[HOSTNAME_LEN], target[HOSTNAME_LEN];
+	size_t off = 12, rdata;
+	unsigned int qd, an, type, rdlen, i;
+
+	if (len < 12) return -1;
+	qd = (msg[4] << 8) | msg[5];
+	an = (msg[6] << 8) | msg[7];
+	for (i = 0; i < qd; i++) {
+		if (!dns_name(msg, len, &off, owner, sizeof(owner)) || (off += 4) > len) return -1;
+	}
+	for (i = 0; i < an; i++) {
+		if (!dns_name(msg, len, &off, owner, sizeof(owner)) || off + 10 > len) return -1;
+		type = (msg[off] << 8) | msg[off + 1];
+		rdlen = (msg[off + 8] << 8) | msg[off + 9];
+		rdata = off + 10;
+		if (rdata + rdlen > len) return -1;
+		if (type == 1 && rdlen == 4) {
+			add_raw_address(&b->found, AF_INET, msg + rdata);
+		} else if (type == 28 && rdlen == 16) {
+			add_raw_address(&b->found, AF_INET6, msg + rdata);
+		} else if (type == 5 || type == 12) {
+			/* CNAME: the last target is the canonical name; PTR: the answer */
+			off = rdata;
+			if (dns_name(msg, len, &off, target, sizeof(target))) {
+				copy_name(b->canon, target);
+			}
+		}
+		off = rdata + rdlen;
+	}
+	return msg[3] & 0x0f;
+}
+
+/* in-addr.arpa or ip6.arpa name for an address */
+void reverse_name(int af, const unsigned char *addr, char *buf, size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+	char *p = buf;
+	int i;
+
+	if (af == AF_INET) {
+		snprintf(buf, len, "%d.%d.%d.%d.in-addr.arpa", addr[3], addr[2], addr[1], addr[0]);
+		return;
+	}
+	for (i = 15; i >= 0; i--) {
+		*p++ = hex[addr[i] & 0xf];
+		*p++ = '.';
+		*p++ = hex[addr[i] >> 4];
+		*p++ = '.';
+	}
+	strcpy(p, "ip6.arpa");
+}
+
+/* A and AAAA (or one PTR) over UDP to one server, in parallel. */
+void dns_lookup(struct backend *b)
+{
+	static const char *rcodes[] = { "NOERROR", "FORMERR", "SERVFAIL", "NXDOMAIN", "NOTIMP", "REFUSED" };
+	unsigned char query[2][300], reply[1232];
+	char qname[HOSTNAME_LEN];
+	size_t qlen[2];
+	int answered[2] = { 0, 0 };
+	int types[2] = { 1, 28 };	/* A, AAAA */
+	unsigned short ids[2];
+	unsigned int seed = (unsigned int)now_ns() ^ (unsigned int)(size_t)b;
+	unsigned long long deadline, t;
+	struct pollfd pfd;
+	ssize_t got;
+	int fd, nq = 2, rcode, i, worst = 0;
+
+	if (b->reverse) {
+		reverse_name(b->family, b->addr, qname, sizeof(qname));
+		types[0] = 12;	/* PTR */
+		nq = 1;
+	} else {
+		copy_name(qname, b->name);
+	}
+	for (i = 0; i < nq; i++) {
+		ids[i] = rand_r(&seed) & 0xffff;
+		if (!(qlen[i] = dns_query(query[i], ids[i], qname, types[i]))) {
+			b->outcome = FAILED;
+			strcpy(b->error, "bad name");
+			return;
+		}
+	}
+	if ((fd = socket(b->server.ss_family, SOCK_DGRAM|SOCK_CLOEXEC, 0)) < 0 ||
+	    connect(fd, (struct sockaddr*)&b->server, b->server_len) < 0) {
+		b->outcome = FAILED;
+		snprintf(b->error, sizeof(b->error), "%s", strerror(errno));
+		if (fd >= 0) close(fd);
+		return;
+	}
+	for (i = 0; i < nq; i++) {
+		if (send(fd, query[i], qlen[i], 0) < 0) {
+			/* the first query's ICMP error can surface here */
+			b->outcome = FAILED;
+			snprintf(b->error, sizeof(b->error), "%s", strerror(errno));
+			close(fd);
+			return;
+		}
+	}
+
+	deadline = now_ns() + (unsigned long long)probe_timeout * 1000000ULL;
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	while ((nq == 1 ? !answered[0] : !(answered[0] && answered[1])) && (t = now_ns()) < deadline) {
+		if (poll(&pfd, 1, (int)((deadline - t + 999999) / 1000000)) <= 0) continue;
+		if ((got = recv(fd, reply, sizeof(reply), 0)) < 0) {
+			/* e.g. ECONNREFUSED: nothing is listening */
+			b->outcome = FAILED;
+			snprintf(b->error, sizeof(b->error), "%s", strerror(errno));
+			close(fd);
+			return;
+		}
+		if (got < 12 || !(reply[2] & 0x80)) continue;
+		for (i = 0; i < nq; i++) {
+			if (answered[i] || ((reply[0] << 8) | reply[1]) != ids[i]) continue;
+			answered[i] = 1;
+			if (reply[2] & 0x02) {
+				rcode = -2;	/* truncated; TCP isn't tried */
+			} else {
+				rcode = dns_answers(b, reply, got);
+			}
+			if (rcode != 0 && (worst == 0 || worst == 3)) worst = rcode;
+		}
+	}
+	close(fd);
+
+	if (nq == 1 ? !answered[0] : !(answered[0] && answered[1])) {
+		b->outcome = FAILED;
+		strcpy(b->error, "timed out");
+	} else if (worst == 3 || (worst == 0 && !b->found.naddrs && !*b->canon)) {
+		b->outcome = NOT_FOUND;
+		strcpy(b->error, worst == 3 ? "NXDOMAIN" : "no data");
+	} else if (worst != 0 && !b->found.naddrs) {
+		b->outcome = FAILED;
+		snprintf(b->error, sizeof(b->error), "%s", worst == -2 ? "truncated" :
+			worst == -1 ? "malformed reply" : worst < 6 ? rcodes[worst] : "rcode error");
+	}
+	if (!b->reverse && b->outcome == FOUND && !*b->canon) {
+		copy_name(b->canon, qname);
+	}
+}
+
+void legacy_lookup(struct backend *b)
+{
+	int herr;
+
+	if (b->reverse) {
+		herr = legacy_byaddr(b->family, b->addr, b->canon);
+	} else {
+		herr = legacy_byname(b->name, b->canon, &b->found);
+	}
+	if (herr != 0) {
+		b->outcome = (herr == HOST_NOT_FOUND || herr == NO_ADDRESS) ? NOT_FOUND : FAILED;
+		snprintf(b->error, sizeof(b->error), "%s", myerr(herr));
+	}
+}
+
+void modern_lookup(struct backend *b)
+{
+	struct addrinfo  hints;
+	struct addrinfo *result;
+	struct addrinfo *res;
+	struct sockaddr_storage ss;
+	socklen_t sslen;
+	int error;
+
+	if (b->reverse) {
+		sslen = make_sockaddr(b->family, b->addr, 0, &ss);
+		error = getnameinfo((struct sockaddr*)&ss, sslen, b->canon, HOSTNAME_LEN, NULL, 0, NI_NAMEREQD);
+	} else {
+		memset(&hints, 0, sizeof(struct addrinfo));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = socktype ? socktype : SOCK_STREAM;
+		hints.ai_flags = AI_CANONNAME|AI_V4MAPPED;
+		if ((error = getaddrinfo(b->name, NULL, &hints, &result)) == 0) {
+			for (res = result; res != NULL; res = res->ai_next) {
+				if (res->ai_canonname && !*b->canon) {
+					copy_name(b->canon, res->ai_canonname);
+				}
+				add_address(&b->found, res->ai_addr);
+			}
+			freeaddrinfo(result);
+		}
+	}
+	if (error != 0) {
+		b->canon[0] = 0;
+		b->outcome = no_such_name(error) ? NOT_FOUND : FAILED;
+		snprintf(b->error, sizeof(b->error), "%s", gai_strerror(error));
+	}
+}
+
+void *backend_thread(void *arg)
+{
+	struct backend *b = (struct backend*)arg;
+	unsigned long long start = now_ns();
+
+	b->outcome = FOUND;
+	b->error[0] = b->canon[0] = 0;
+	b->found.naddrs = 0;
+	switch (b->kind) {
+	case BACKEND_LEGACY: legacy_lookup(b); break;
+	case BACKEND_MODERN: modern_lookup(b); break;
+	case BACKEND_DNS: dns_lookup(b); break;
+	}
+	b->ns = now_ns() - start;
+	return NULL;
+}
+
+int same_name(const char *a, const char *b)
+{
+	size_t la = strlen(a), lb = strlen(b);
+	if (la && a[la - 1] == '.') la--;
+	if (lb && b[lb - 1] == '.') lb--;
+	return la == lb && strncasecmp(a, b, la) == 0;
+}
+
+/* Prints where the backends disagree; returns the number of differences. */
+int compare_backends(void)
+{
+	struct resolution all;
+	struct backend *b, *first = NULL;
+	char text[INET6_ADDRSTRLEN];
+	int differ = 0, nfound = 0, v4 = 0, i, k;
+
+	all.naddrs = 0;
+	for (i = 0; i < nbackends; i++) {
+		b = &backends[i];
+		if (b->outcome == FOUND) {
+			nfound ++;
+			if (!first) first = b;
+			for (k = 0; k < b->found.naddrs; k++) {
+				add_raw_address(&all, b->found.addrs[k].family, b->found.addrs[k].addr);
+				v4 |= b->found.addrs[k].family == AF_INET;
+			}
+		}
+	}
+
+	if (!nfound) {
+		/* all NOT_FOUND is agreement; anything else is worth a look */
+		for (i = 0; i < nbackends; i++) {
+			if (backends[i].outcome == FAILED) {
+				printf("  ! no backend answered\n");
+				return 1;
+			}
+		}
+		return 0;
+	}
+
+	/* one backend failing where others answered */
+	for (i = 0; i < nbackends; i++) {
+		b = &backends[i];
+		if (b->outcome == NOT_FOUND && !b->v6 && !v4) continue;	/* IPv6-only name */
+		if (b->outcome != FOUND) {
+			printf("  ! %s: %s, but %s answered\n", b->label, b->error, first->label);
+			differ ++;
+		}
+	}
+
+	/* each address, against every backend that answered and could have had it */
+	for (k = 0; k < all.naddrs; k++) {
+		format_addr(all.addrs[k].family, all.addrs[k].addr, text, sizeof(text));
+		for (i = 0; i < nbackends; i++) {
+			b = &backends[i];
+			if (b->outcome != FOUND || (all.addrs[k].family == AF_INET6 && !b->v6)) continue;
+			if (find_addr(&b->found, &all.addrs[k]) < 0) {
+				printf("  ! %s: no %s\n", b->label, text);
+				differ ++;
+			}
+		}
+	}
+
+	for (i = 0; i < nbackends; i++) {
+		b = &backends[i];
+		if (b->outcome == FOUND && b != first && *b->canon && *first->canon && !same_name(b->canon, first->canon)) {
+			printf("  ! %s: %s \"%s\", but %s has \"%s\"\n", b->label, backends[0].reverse ? "name" : "canonname",
+				b->canon, first->label, first->canon);
+			differ ++;
+		}
+	}
+	return differ;
+}
+
+int run_compare(void)
+{
+	struct backend *b;
+	char text[INET6_ADDRSTRLEN];
+	int status = EXIT_SUCCESS;
+	int i, j, k;
+
+	backends[0].kind = BACKEND_LEGACY;
+	strcpy(backends[0].label, "gethostbyname");
+	backends[1].kind = BACKEND_MODERN;
+	strcpy(backends[1].label, "getaddrinfo");
+	backends[1].v6 = 1;
+	nbackends = 2;
+	load_nameservers();
+
+	for (j = 0; j < nnames; j++) {
+		printf("***\n*** %s\n***\n\n", names[j]);
+		for (i = 0; i < nbackends; i++) {
+			b = &backends[i];
+			b->name = names[j];
+			b->reverse = 0;
+			if (inet_pton(AF_INET, names[j], b->addr) == 1) {
+				b->reverse = 1;
+				b->family = AF_INET;
+			} else if (inet_pton(AF_INET6, names[j], b->addr) == 1) {
+				b->reverse = 1;
+				b->family = AF_INET6;
+			}
+			if (pthread_create(&b->thread, NULL, backend_thread, b) != 0) {
+				backend_thread(b);
+				b->thread = 0;
+			}
+		}
+		if (backends[0].reverse) {
+			strcpy(backends[0].label, "gethostbyaddr");
+			strcpy(backends[1].label, "getnameinfo");
+		} else {
+			strcpy(backends[0].label, "gethostbyname");
+			strcpy(backends[1].label, "getaddrinfo");
+		}
+		for (i = 0; i < nbackends; i++) {
+			if (backends[i].thread) {
+				pthread_join(backends[i].thread, NULL);
+			}
+		}
+
+		for (i = 0; i < nbackends; i++) {
+			b = &backends[i];
+			printf("  %-20s %10.3f ms  ", b->label, b->ns / 1e6);
+			if (b->outcome != FOUND) {
+				printf("%s\n", b->error);
+				continue;
+			}
+			if (*b->canon) {
+				printf("%s", b->canon);
+			}
+			for (k = 0; k < b->found.naddrs; k++) {
+				format_addr(b->found.addrs[k].family, b->found.addrs[k].addr, text, sizeof(text));
+				printf(" %s", text);
+			}
+			printf("\n");
+		}
+		if (compare_backends() == 0) {
+			printf("  = agree\n");
+		} else {
+			status = EXIT_FAILURE;
+		}
+		printf("\n");
+	}
+	return status;
+}
+
+/*
+ * COMMAND LINE
+ */
+
+void show_help(void)
+{
+	printf("usage: hostlookup [OPTIONS] [NAME|ADDRESS ...]\n");
+	printf("\n");
+	printf("Without options, dumps the results of the legacy and modern resolver\n");
+	printf("calls for each NAME or ADDRESS.\n");
+	printf("\n");
+	printf("OPTIONS:\n");
+	printf("\n");
+	printf(" --names=FILE\n   also read names from FILE (one per line; - for stdin).\n");
+	printf("\n");
+	printf(" --batch\n   resolve the names in parallel, and print one line for each:\n");
+	printf("   NAME <tab> CANONNAME <tab> ADDRESS[=PTR] ...\n");
+	printf(" --retries=#\n   retry lookups that fail with TRY_AGAIN or EAI_AGAIN up to # times.\n");
+	printf("   Default is 3.  Each failure also halves the number of lookups in\n");
+	printf("   flight, which then grows back towards --concurrency.\n");
+	printf(" --backoff=#\n   wait about # milliseconds before the first retry, doubling for\n");
+	printf("   each one after.  Default is 100.\n");
+	printf(" --snapshot=FILE\n   with --batch, answer names from FILE where the results are still\n");
+	printf("   fresh, resolve the rest, and save the results back to FILE.\n");
+	printf(" --ttl=INTERVAL\n   how long new results stay fresh (#, #s, #m or #h).  Default is 1h.\n");
+	printf("\n");
+	printf(" --bench\n   replay the names through the same lookups and report throughput,\n");
+	printf("   latency and errors instead of dumping the results.\n");
+	printf(" --duration=#\n   run the benchmark for # seconds.  Default is 10.\n");
+	printf(" --rate=#\n   issue # queries per second, regardless of completions (open loop).\n");
+	printf("   Latency is measured from when each query was due.\n");
+	printf(" --concurrency=#\n   use # worker threads.  Without --rate, each worker issues its next\n");
+	printf("   query as soon as the last one completes.  Default is 8, or 64 with --rate.\n");
+	printf("\n");
+	printf(" --sweep=CIDR\n   reverse-resolve every address in an IPv4 or IPv6 prefix, and print\n");
+	printf("   the ones with a PTR record.  May be repeated.  Uses --concurrency\n");
+	printf("   workers (default 32), and --rate if given.\n");
+	printf("\n");
+	printf(" --watch=INTERVAL\n   resolve the names every INTERVAL (#, #s, #m or #h), and print only\n");
+	printf("   what changed: addresses added or removed, canonical names, PTRs and\n");
+	printf("   errors.  The first pass prints everything.\n");
+	printf(" --count=#\n   stop watching after # passes.  Default is to keep going.\n");
+	printf("\n");
+	printf(" --probe=PORT\n   connect to every TCP address for each name at once, and rank them by\n");
+	printf("   how quickly they connected.\n");
+	printf(" --timeout=#\n   give up on a connection after # milliseconds.  Default is 3000.\n");
+	printf("\n");
+	printf(" --enrich[=FILE]\n   copy a log from FILE (default stdin) to stdout, inserting the PTR for\n");
+	printf("   each IPv4 or IPv6 address after it, as ADDRESS[NAME].  Each distinct\n");
+	printf("   address is looked up once, using the batch scheduler.\n");
+	printf("\n");
+	printf(" --serve=SOCKET\n   answer lookups from other processes on a UNIX domain socket, one name\n");
+	printf("   per line, in the --batch format.  Identical lookups that arrive while\n");
+	printf("   one is in flight share its result.\n");
+	printf(" --client=SOCKET\n   look the names up through a --serve process.  With --bench, also\n");
+	printf("   report how many upstream lookups the server saved.\n");
+	printf("\n");
+	printf(" --compare\n   look each name up with gethostbyname(), getaddrinfo() and a direct\n");
+	printf("   query to each nameserver in /etc/resolv.conf, all at once, and show\n");
+	printf("   how long each took and where they disagree.  Addresses are looked up\n");
+	printf("   with gethostbyaddr(), getnameinfo() and PTR queries.  Uses --timeout.\n");
+	printf("\n");
+	printf(" --split\n   look up AF_INET and AF_INET6 addresses concurrently instead of with\n");
+	printf("   one AF_UNSPEC getaddrinfo(), and show how long each family took.\n");
+	printf("   Implies --socktype=stream unless another type is given.\n");
+	printf(" --socktype=stream|dgram|raw\n   ask getaddrinfo() for one socket type only, instead of all three.\n");
+	printf("\n");
+	printf(" --hosts[=FILE]\n   answer names and addresses found in FILE (default /etc/hosts) from an\n");
+	printf("   in-memory index, falling back to NSS for the rest.  With --bench, the\n");
+	printf("   names are run through NSS and then through the index, for comparison.\n");
+	printf("\n");
+	printf(" --no-legacy\n   skip gethostbyname()/gethostbyaddr().\n");
+	printf(" --no-reverse\n   skip getnameinfo() on the returned addresses.\n");
+	printf("\n");
+	printf(" -?  --help\n   show this help information, and quit.\n");
+}
+
+void bad_parameter(const char* param)
+{
+	fprintf(stderr, "Unrecognised parameter: %s\n", param);
+	exit(1);
+}
+
+int starts_with(const char* long_str, const char* short_str)
+{
+	return strncmp(long_str, short_str, strlen(short_str)) == 0;
+}
+
+void get_number(int* var, const char* arg, const char* message)
+{
+	int n = atoi(arg);
+	if (n < 1) {
+		fprintf(stderr, "Invalid %s: %s\n", message, arg);
+		exit(4);
+	}
+	*var = n;
+}
+
+void get_socktype(int* var, const char* arg)
+{
+	if (strcasecmp(arg, "stream") == 0) {*var = SOCK_STREAM; return;}
+	if (strcasecmp(arg, "dgram") == 0) {*var = SOCK_DGRAM; return;}
+	if (strcasecmp(arg, "raw") == 0) {*var = SOCK_RAW; return;}
+	fprintf(stderr, "Invalid socktype: %s\nExpected stream, dgram or raw\n", arg);
+	exit(5);
+}
+
+void parse_command_line(int argc, char *argv[])
+{
+	int i;
+	char *arg;
+
+	for (i = 1; i < argc; i++) {
+		arg = argv[i];
+		if (arg[0] != '-') {
+			add_name(arg);
+		} else if (strcmp(arg, "-?") == 0 || strcmp(arg, "--help") == 0) {
+			show_help();
+			exit(0);
+		} else if (starts_with(arg, "--names=")) {
+			load_names(arg + 8);
+		} else if (strcmp(arg, "--batch") == 0) {
+			batch = 1;
+		} else if (starts_with(arg, "--retries=")) {
+			retries = atoi(arg + 10);
+			if (retries < 0 || (retries == 0 && strcmp(arg + 10, "0") != 0)) {
+				fprintf(stderr, "Invalid retries: %s\n", arg + 10);
+				exit(4);
+			}
+		} else if (starts_with(arg, "--backoff=")) {
+			get_number(&backoff_ms, arg + 10, "backoff");
+		} else if (starts_with(arg, "--snapshot=")) {
+			snapshot_path = arg + 11;
+			batch = 1;
+		} else if (starts_with(arg, "--ttl=")) {
+			if (!(snapshot_ttl = parse_interval(arg + 6))) {
+				fprintf(stderr, "Invalid interval: %s\n", arg + 6);
+				exit(4);
+			}
+		} else if (strcmp(arg, "--bench") == 0) {
+			bench = 1;
+		} else if (starts_with(arg, "--duration=")) {
+			get_number(&bench_duration, arg + 11, "duration");
+		} else if (starts_with(arg, "--rate=")) {
+			get_number(&query_rate, arg + 7, "rate");
+		} else if (starts_with(arg, "--concurrency=")) {
+			get_number(&concurrency, arg + 14, "concurrency");
+		} else if (starts_with(arg, "--sweep=")) {
+			sweeps = realloc(sweeps, (nsweeps + 1) * sizeof(*sweeps));
+			if (!sweeps) {
+				perror("realloc");
+				exit(EXIT_FAILURE);
+			}
+			sweeps[nsweeps++] = arg + 8;
+		} else if (starts_with(arg, "--watch=")) {
+			if (!(watch_interval = parse_interval(arg + 8))) {
+				fprintf(stderr, "Invalid interval: %s\n", arg + 8);
+				exit(4);
+			}
+		} else if (starts_with(arg, "--count=")) {
+			get_number(&watch_count, arg + 8, "count");
+		} else if (starts_with(arg, "--probe=")) {
+			get_number(&probe_port, arg + 8, "port");
+			if (probe_port > 65535) {
+				fprintf(stderr, "Invalid port: %s\n", arg + 8);
+				exit(4);
+			}
+		} else if (starts_with(arg, "--timeout=")) {
+			get_number(&probe_timeout, arg + 10, "timeout");
+		} else if (strcmp(arg, "--enrich") == 0) {
+			enrich_path = "-";
+		} else if (starts_with(arg, "--enrich=")) {
+			enrich_path = arg + 9;
+		} else if (starts_with(arg, "--serve=")) {
+			serve_path = arg + 8;
+		} else if (starts_with(arg, "--client=")) {
+			client_path = arg + 9;
+		} else if (strcmp(arg, "--compare") == 0) {
+			compare = 1;
+		} else if (strcmp(arg, "--split") == 0) {
+			split_families = 1;
+		} else if (starts_with(arg, "--socktype=")) {
+			get_socktype(&socktype, arg + 11);
+		} else if (strcmp(arg, "--hosts") == 0) {
+			hosts_path = "/etc/hosts";
+		} else if (starts_with(arg, "--hosts=")) {
+			hosts_path = arg + 8;
+		} else if (strcmp(arg, "--no-legacy") == 0) {
+			lookup_flags &= ~RESOLVE_LEGACY;
+		} else if (strcmp(arg, "--no-reverse") == 0) {
+			lookup_flags &= ~RESOLVE_REVERSE;
+		} else {
+			bad_parameter(arg);
+		}
+	}
+
+	/* one answer per address, unless asked for another type */
+	if (split_families && !socktype) {
+		socktype = SOCK_STREAM;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int error;
+	int i;
+
+	parse_command_line(argc, argv);
+
+	if (hosts_path && !(hosts = hosts_open(hosts_path, serve_path || watch_interval))) {
+		return EXIT_FAILURE;
+	}
+
+	if (serve_path) {
+		return run_serve();
+	}
+
+	if (bench) {
+		return run_bench();
+	}
+
+	if (client_path) {
+		return run_client();
+	}
+
+	if (watch_interval) {
+		return run_watch();
+	}
+
+	if (batch) {
+		return run_batch();
+	}
+
+	if (enrich_path) {
+		return run_enrich(enrich_path);
+	}
+
+	if (compare) {
+		return run_compare();
+	}
+
+	if (probe_port) {
+		error = EXIT_SUCCESS;
+		for (i = 0; i < nnames; i++) {
+			if (run_probe(names[i]) != EXIT_SUCCESS) {
+				error = EXIT_FAILURE;
+			}
+		}
+		return error;
+	}
+
+	if (nsweeps) {
+		for (i = 0; i < nsweeps; i++) {
+			if (run_sweep(sweeps[i]) != EXIT_SUCCESS) {
+				return EXIT_FAILURE;
+			}
+		}
+		return EXIT_SUCCESS;
+	}
+
+	for (i = 0; i < nnames; i++) {
+		if (dump_name(names[i]) != EXIT_SUCCESS) {
+			return EXIT_FAILURE;
+		}
 	}
 	return EXIT_SUCCESS;
 }